@@ -1,5 +1,7 @@
 /* Simple Operating System Framework in C
- * Demonstrates basic file operations: List, Move, Rename, Delete, Create, Write, Read, Mkdir, Rmdir, Copy, CD
+ * Demonstrates basic file operations: List, Move, Rename, Delete, Create, Write, Read, Mkdir, Rmdir, Copy, CD, Du, Quota
+ * and scripted processes: Run, Ps, Kill, scheduled on a work-stealing thread pool,
+ * change notification: Watch, Unwatch, and bulk transfer with the host: Import, Export
  */
 
 #include <stdio.h>
@@ -7,53 +9,366 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
-
-#define MAX_COMMAND_LENGTH 100
-#define MAX_FILENAME_LENGTH 50
-#define MAX_FILES 100
-
-/* Simple file structure */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define MAX_PROCESSES 64
+#define MAX_WATCHERS 16
+#define WATCH_QUEUE_LENGTH 1024 /* Events per watcher, a power of two */
+#define WATCH_SPIN_ROUNDS 200   /* Yields before a watcher goes to sleep */
+
+/* Orders a directory listing can be produced in */
+typedef enum
+{
+    SORT_NAME, /* By name */
+    SORT_SIZE, /* Largest first, then by name */
+    SORT_TYPE, /* Directories first, then by name */
+    SORT_ORDERS
+} SortOrder;
+
+/* Simple file structure. An entry is named by its parent and an interned
+ * path component, so full paths are never stored and have no length limit.
+ */
 typedef struct
 {
-    char name[MAX_FILENAME_LENGTH];
-    char content[1024];
+    int nameId;      /* Interned name within the parent directory */
+    int parent;      /* Index of the containing directory, -1 for root */
+    char *content;   /* Heap copy of the content, NULL when empty */
+    long size;       /* Length of content in bytes */
     bool exists;
     bool isDirectory;
     int permissions; /* Simple permissions: 1=read, 2=write, 4=execute */
+
+    /* Directory usage, maintained incrementally on every change below it */
+    long usedBytes;   /* Bytes stored in the subtree */
+    int usedEntries;  /* Entries stored in the subtree */
+    long quotaBytes;  /* Byte limit for the subtree, 0 = unlimited */
+    int quotaEntries; /* Entry limit for the subtree, 0 = unlimited */
+
+    /* Directory children, kept sorted once per order so pages are cheap */
+    int *children[SORT_ORDERS];
+    int childCount;
+    int childCapacity;
 } File;
 
-/* OS State */
+/* Interned path components. Each distinct component is stored once in text
+ * and identified by its ID, so equal names compare as equal integers.
+ */
+typedef struct
+{
+    char *text;    /* NUL-terminated components, back to back */
+    size_t textSize;
+    size_t textCapacity;
+    size_t *offsets; /* Start of each component in text, by ID */
+    int count;
+    int capacity;
+    int *slots;    /* Open-addressing hash of IDs, -1 when empty */
+    int slotCount; /* Power of two */
+} NameTable;
+
+/* Sort key of an entry; also what a listing cursor remembers */
+typedef struct
+{
+    bool isDirectory;
+    long size;
+    int index;
+    char *name; /* Name within the parent directory */
+} ListKey;
+
+/* Unit of work run by the thread pool */
+typedef struct
+{
+    void (*run)(void *arg);
+    void *arg;
+} Task;
+
+typedef struct ThreadPool ThreadPool;
+
+/* A pool thread and its run queue: the owner takes tasks from the head,
+ * idle workers steal from the tail.
+ */
+typedef struct
+{
+    ThreadPool *pool;
+    int index;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Task *tasks; /* Ring buffer */
+    int head;
+    int count;
+    int capacity;
+} Worker;
+
+struct ThreadPool
+{
+    Worker *workers;
+    int workerCount;
+    atomic_int nextWorker; /* Round-robin target for tasks submitted from outside the pool */
+    atomic_int queued;     /* Tasks waiting in any run queue */
+    atomic_int pending;    /* Tasks queued or running */
+    atomic_int sleepers;   /* Workers waiting on wake */
+
+    pthread_mutex_t lock; /* Only taken to sleep and to wake sleepers */
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    bool stopping;
+};
+
+typedef enum
+{
+    PROCESS_FREE,
+    PROCESS_READY,
+    PROCESS_RUNNING,
+    PROCESS_EXITED,
+    PROCESS_KILLED
+} ProcessState;
+
+/* Change reported to watchers */
+typedef enum
+{
+    EVENT_CREATE,
+    EVENT_WRITE,
+    EVENT_DELETE,
+    EVENT_MOVE,
+    EVENT_RENAME,
+    EVENT_CHMOD,
+    EVENT_MKDIR,
+    EVENT_RMDIR,
+    EVENT_OVERFLOW /* Marks events lost while the queue was full */
+} EventType;
+
+/* A path built once per change and shared by every watcher that queues it */
+typedef struct
+{
+    atomic_int references;
+    char text[];
+} SharedPath;
+
+typedef struct
+{
+    EventType type;
+    SharedPath *path; /* Referenced by the event, released by the consumer */
+    SharedPath *from; /* EVENT_MOVE, EVENT_RENAME: previous path */
+} WatchEvent;
+
+/* A subscriber to changes in one subtree. Events go through a single-producer,
+ * single-consumer ring: producers always hold the file system write lock, so
+ * only one writes at a time, and the watcher's own thread is the consumer.
+ * The last slot is kept for an overflow marker, so a drop is always reported.
+ */
+typedef struct
+{
+    int id;
+    int root; /* Entry whose subtree is watched */
+    WatchEvent events[WATCH_QUEUE_LENGTH];
+    atomic_size_t head; /* Next event to consume */
+    atomic_size_t tail; /* Next free slot */
+    atomic_long dropped; /* Events lost; the consumer takes the count at each marker */
+    size_t marker;       /* Producer side: position of the last overflow marker */
+    atomic_bool active;
+
+    /* Only used once the consumer has run out of work and gone to sleep */
+    atomic_bool sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t consumer;
+} Watcher;
+
+struct OSState;
+
+/* A host file or directory on its way into SimpleOS. Workers fill these in
+ * and queue them; the importing thread links them into the file system.
+ */
+typedef struct ImportNode
+{
+    struct ImportJob *job;
+    struct ImportNode *next;      /* Link in the job's ready queue */
+    struct ImportNode *parent;    /* Directory it goes in, NULL for the import root */
+    struct ImportNode *nextDirectory; /* Link in the job's list of directories */
+    char *hostPath;
+    char *name; /* Last component of hostPath */
+    bool isDirectory;
+    int permissions;
+    char *content; /* Whole body, read straight into the buffer the entry adopts */
+    long size;
+    int index; /* Directories: entry they were imported as, -1 if that failed */
+} ImportNode;
+
+typedef struct ImportJob
+{
+    ThreadPool pool;
+    pthread_mutex_t lock; /* Guards the queue, outstanding and directories */
+    pthread_cond_t ready;
+    ImportNode *head; /* Nodes waiting to be linked in */
+    ImportNode *tail;
+    int outstanding; /* Tasks submitted and not yet finished */
+    ImportNode *directories;
+    atomic_int errors;
+    atomic_bool stopped; /* Set when a quota stops the import; workers stop reading */
+} ImportJob;
+
+typedef struct ExportJob
+{
+    struct OSState *os;
+    ThreadPool pool;
+    atomic_int files;
+    atomic_int directories;
+    atomic_int errors;
+} ExportJob;
+
+/* One file or directory to write out to the host */
+typedef struct
+{
+    ExportJob *job;
+    int index;
+    char *hostPath;
+} ExportItem;
+
+/* A script being executed one command per time slice. Only the slice that
+ * owns the process moves it to EXITED or KILLED, after which the slot may be reused.
+ */
 typedef struct
 {
-    File files[MAX_FILES];
+    struct OSState *os;
+    int pid;
+    ProcessState state;
+    bool killRequested;
+    bool exitRequested; /* Set by the script's own exit command */
+    char *script;
+    int currentDirectory;
+    char *commands; /* Private copy of the script, consumed by strtok_r */
+    char *nextCommand;
+    int commandsRun;
+} Process;
+
+/* OS State */
+typedef struct OSState
+{
+    File *files;
     int fileCount;
+    int fileCapacity;
+    NameTable names;
+    int *entrySlots;    /* Open-addressing hash of entries by (parent, nameId), -1 when empty */
+    int entrySlotCount; /* Power of two */
+    int entrySlotsUsed;
     bool running;
-    char currentDirectory[MAX_FILENAME_LENGTH];
+    int currentDirectory;
+
+    /* Readers (ls, cat, du, ...) share the file system, everything else is exclusive */
+    pthread_rwlock_t lock;
+
+    /* Process table, guarded by processLock; taken after lock when both are held */
+    Process processes[MAX_PROCESSES];
+    int nextPid;
+    bool shuttingDown; /* Set by exit; no new processes start after it */
+    pthread_mutex_t processLock;
+    ThreadPool scheduler;
+
+    /* Change subscribers, only changed under the write lock */
+    Watcher *watchers[MAX_WATCHERS];
+    int watcherCount;
+    int nextWatchId;
 } OSState;
 
 /* Function prototypes */
 void initializeOS(OSState *os);
 void showPrompt(OSState *os);
-void processCommand(OSState *os, char *command);
-void listFiles(OSState *os);
-void moveFile(OSState *os, char *source, char *destination);
-void renameFile(OSState *os, char *oldname, char *newname);
-void deleteFile(OSState *os, char *filename);
-void createFile(OSState *os, char *filename);
-void writeToFile(OSState *os, char *filename, char *content);
-void readFile(OSState *os, char *filename);
-void makeDirectory(OSState *os, char *dirname);
-void removeDirectory(OSState *os, char *dirname);
-void changeDirectory(OSState *os, char *dirname);
-void setPermissions(OSState *os, char *filename, int permissions);
-void copyFile(OSState *os, char *source, char *destination);
+void processCommand(OSState *os, Process *process, char *command);
+void listFiles(OSState *os, int cwd, SortOrder order, int pageSize, char *cursor);
+void moveFile(OSState *os, int cwd, char *source, char *destination);
+void renameFile(OSState *os, int cwd, char *oldname, char *newname);
+void deleteFile(OSState *os, int cwd, char *filename);
+void createFile(OSState *os, int cwd, char *filename);
+void writeToFile(OSState *os, int cwd, char *filename, char *content);
+void readFile(OSState *os, int cwd, char *filename);
+void makeDirectory(OSState *os, int cwd, char *dirname);
+void removeDirectory(OSState *os, int cwd, char *dirname);
+void changeDirectory(OSState *os, int *cwd, char *dirname);
+void setPermissions(OSState *os, int cwd, char *filename, int permissions);
+void copyFile(OSState *os, int cwd, char *source, char *destination);
+void diskUsage(OSState *os, int cwd, char *path);
+void setQuota(OSState *os, int cwd, char *dirname, long bytes, int entries);
 void showHelp();
-bool isDirectoryEmpty(OSState *os, char *dirname);
+bool isDirectoryEmpty(OSState *os, int dirIndex);
+int internName(NameTable *names, const char *name, size_t length);
+int lookupName(NameTable *names, const char *name, size_t length);
+char *nameText(NameTable *names, int nameId);
+unsigned int hashName(const char *name, size_t length);
+unsigned int hashEntry(int parent, int nameId);
+int findChild(OSState *os, int dirIndex, int nameId);
+void addEntrySlot(OSState *os, int index);
+void removeEntrySlot(OSState *os, int index);
+int resolvePrefix(OSState *os, int cwd, char *path, size_t length);
+int resolvePath(OSState *os, int cwd, char *path);
+int resolveParent(OSState *os, int cwd, char *path, char **leaf, size_t *leafLength);
+char *entryPath(OSState *os, int index);
+size_t pathLength(OSState *os, int index);
+void writePath(OSState *os, int index, char *path, size_t length);
+SharedPath *sharePath(OSState *os, int index);
+void releasePath(SharedPath *path);
+int createEntry(OSState *os, int parent, int nameId, bool isDirectory, int permissions);
+int allocateEntry(OSState *os, int parent, int nameId, bool isDirectory, int permissions);
+void storeContent(OSState *os, int index, const char *content, long size);
+bool relocateEntry(OSState *os, int index, int newParent, int newNameId);
+bool isAncestor(OSState *os, int ancestor, int index);
+int entryDepth(OSState *os, int index);
+int commonAncestor(OSState *os, int a, int b);
+bool checkQuota(OSState *os, int dirIndex, int skipShared, long bytes, int entries);
+void updateUsage(OSState *os, int dirIndex, long bytes, int entries);
+void initializeEntry(File *file, int nameId, bool isDirectory, int permissions);
+void linkChild(OSState *os, int index);
+void appendChild(OSState *os, int index);
+void reserveChild(OSState *os, int dirIndex);
+void sortChildren(OSState *os, int dirIndex);
+int compareSortContext(const void *a, const void *b);
+void resizeEntry(OSState *os, int index, long size);
+void unlinkChild(OSState *os, int index);
+void insertSorted(OSState *os, int dirIndex, SortOrder order, int index);
+void removeSorted(OSState *os, int dirIndex, SortOrder order, int index);
+int findListPosition(OSState *os, int dirIndex, SortOrder order, ListKey *key, bool after);
+ListKey entryKey(OSState *os, int index);
+int compareKeys(SortOrder order, ListKey *a, ListKey *b);
+void runScript(OSState *os, int cwd, char *script);
+void listProcesses(OSState *os);
+void killProcess(OSState *os, int pid);
+void runProcessSlice(void *arg);
+void shutdownOS(OSState *os);
+void startThreadPool(ThreadPool *pool, int workerCount);
+void stopThreadPool(ThreadPool *pool);
+void submitTask(ThreadPool *pool, void (*run)(void *arg), void *arg);
+bool takeTask(ThreadPool *pool, int worker, Task *task);
+bool isReadOnlyCommand(char *cmd);
+void *workerMain(void *arg);
+void *reallocOrExit(void *pointer, size_t size);
+void watchPath(OSState *os, int cwd, char *path);
+void unwatchPath(OSState *os, int id);
+void stopWatcher(Watcher *watcher);
+void publishEvent(OSState *os, EventType type, int index, int oldParent, SharedPath *oldPath);
+void pushEvent(Watcher *watcher, EventType type, SharedPath *path, SharedPath *from);
+void *watchConsumer(void *arg);
+int coreCount();
+char *joinPath(const char *directory, const char *name);
+void importTree(OSState *os, int cwd, char *hostDirectory, char *dirname);
+void linkImported(OSState *os, ImportNode *node, int *files, int *directories);
+void submitImport(ImportJob *job, void (*run)(void *arg), ImportNode *node);
+void queueImported(ImportJob *job, ImportNode *node);
+void finishImportTask(ImportJob *job);
+void scanHostDirectory(void *arg);
+void loadHostFile(void *arg);
+void exportTree(OSState *os, int cwd, char *dirname, char *hostDirectory);
+void exportDirectory(void *arg);
+void exportFile(void *arg);
 
 int main()
 {
     OSState os;
-    char command[MAX_COMMAND_LENGTH];
+    char *command = NULL;
+    size_t commandCapacity = 0;
 
     /* Initialize the OS */
     initializeOS(&os);
@@ -65,8 +380,8 @@ int main()
     {
         showPrompt(&os);
 
-        /* Get user input */
-        if (fgets(command, MAX_COMMAND_LENGTH, stdin) == NULL)
+        /* Get user input; lines of any length are accepted */
+        if (getline(&command, &commandCapacity, stdin) == -1)
         {
             break;
         }
@@ -75,119 +390,338 @@ int main()
         command[strcspn(command, "\n")] = 0;
 
         /* Process the command */
-        processCommand(&os, command);
+        processCommand(&os, NULL, command);
     }
 
     printf("OS shutting down...\n");
+    free(command);
+    shutdownOS(&os);
     return 0;
 }
 
 void initializeOS(OSState *os)
 {
+    os->files = NULL;
     os->fileCount = 0;
+    os->fileCapacity = 0;
+    memset(&os->names, 0, sizeof(os->names));
+    os->entrySlots = NULL;
+    os->entrySlotCount = 0;
+    os->entrySlotsUsed = 0;
     os->running = true;
-    strcpy(os->currentDirectory, "/");
 
     /* Create root directory */
-    strcpy(os->files[0].name, "/");
-    os->files[0].content[0] = '\0';
-    os->files[0].exists = true;
-    os->files[0].isDirectory = true;
-    os->files[0].permissions = 7; /* rwx */
+    os->currentDirectory = createEntry(os, -1, internName(&os->names, "", 0), true, 7); /* rwx */
 
     /* Create a few sample files */
-    strcpy(os->files[1].name, "readme.txt");
-    strcpy(os->files[1].content, "Welcome to SimpleOS!");
-    os->files[1].exists = true;
-    os->files[1].isDirectory = false;
-    os->files[1].permissions = 6; /* rw- */
-
-    strcpy(os->files[2].name, "sample.txt");
-    strcpy(os->files[2].content, "This is a sample file.");
-    os->files[2].exists = true;
-    os->files[2].isDirectory = false;
-    os->files[2].permissions = 6; /* rw- */
+    int readme = createEntry(os, 0, internName(&os->names, "readme.txt", 10), false, 6); /* rw- */
+    storeContent(os, readme, "Welcome to SimpleOS!", 20);
+    int sample = createEntry(os, 0, internName(&os->names, "sample.txt", 10), false, 6); /* rw- */
+    storeContent(os, sample, "This is a sample file.", 22);
 
     /* Create a sample directory */
-    strcpy(os->files[3].name, "docs");
-    os->files[3].content[0] = '\0';
-    os->files[3].exists = true;
-    os->files[3].isDirectory = true;
-    os->files[3].permissions = 7; /* rwx */
+    createEntry(os, 0, internName(&os->names, "docs", 4), true, 7); /* rwx */
+
+    /* Start the scheduler with one worker per core */
+    pthread_rwlock_init(&os->lock, NULL);
+    pthread_mutex_init(&os->processLock, NULL);
+    for (int i = 0; i < MAX_PROCESSES; i++)
+    {
+        os->processes[i].state = PROCESS_FREE;
+        os->processes[i].script = NULL;
+    }
+    os->nextPid = 1;
+    os->shuttingDown = false;
+    os->watcherCount = 0;
+    os->nextWatchId = 1;
+
+    startThreadPool(&os->scheduler, coreCount());
+}
+
+/* Kill every process, wait for the scheduler to drain and release the file system */
+void shutdownOS(OSState *os)
+{
+    pthread_mutex_lock(&os->processLock);
+    os->shuttingDown = true;
+    for (int i = 0; i < MAX_PROCESSES; i++)
+    {
+        if (os->processes[i].state == PROCESS_READY || os->processes[i].state == PROCESS_RUNNING)
+        {
+            os->processes[i].killRequested = true;
+        }
+    }
+    pthread_mutex_unlock(&os->processLock);
+
+    stopThreadPool(&os->scheduler);
+    for (int i = 0; i < os->watcherCount; i++)
+    {
+        stopWatcher(os->watchers[i]);
+    }
+    pthread_mutex_destroy(&os->processLock);
+    pthread_rwlock_destroy(&os->lock);
+
+    for (int i = 0; i < MAX_PROCESSES; i++)
+    {
+        free(os->processes[i].script);
+    }
+    for (int i = 0; i < os->fileCount; i++)
+    {
+        free(os->files[i].content);
+        for (int order = 0; order < SORT_ORDERS; order++)
+        {
+            free(os->files[i].children[order]);
+        }
+    }
+    free(os->files);
+    free(os->entrySlots);
+    free(os->names.text);
+    free(os->names.offsets);
+    free(os->names.slots);
+}
 
-    os->fileCount = 4;
+/* Fill in a fresh, empty entry; the caller links it to its parent */
+void initializeEntry(File *file, int nameId, bool isDirectory, int permissions)
+{
+    file->nameId = nameId;
+    file->parent = -1;
+    file->content = NULL;
+    file->size = 0;
+    file->exists = true;
+    file->isDirectory = isDirectory;
+    file->permissions = permissions;
+    file->usedBytes = 0;
+    file->usedEntries = 0;
+    file->quotaBytes = 0;
+    file->quotaEntries = 0;
+    for (int order = 0; order < SORT_ORDERS; order++)
+    {
+        file->children[order] = NULL;
+    }
+    file->childCount = 0;
+    file->childCapacity = 0;
 }
 
 void showPrompt(OSState *os)
 {
-    printf("%s> ", os->currentDirectory);
+    pthread_rwlock_rdlock(&os->lock);
+    char *path = entryPath(os, os->currentDirectory);
+    pthread_rwlock_unlock(&os->lock);
+
+    printf("%s> ", path);
+    free(path);
+}
+
+/* Commands that only read the file system and may run side by side */
+bool isReadOnlyCommand(char *cmd)
+{
+    static const char *readers[] = {"list", "ls", "read", "cat", "du", "help", "run", "ps", "kill", "export"};
+
+    for (size_t i = 0; i < sizeof(readers) / sizeof(readers[0]); i++)
+    {
+        if (strcmp(cmd, readers[i]) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-void processCommand(OSState *os, char *command)
+/* Run one command for the interactive shell (process == NULL) or for a process */
+void processCommand(OSState *os, Process *process, char *command)
 {
-    char cmd[MAX_COMMAND_LENGTH];
-    char arg1[MAX_FILENAME_LENGTH];
-    char arg2[MAX_FILENAME_LENGTH];
+    char *words[4] = {"", "", "", ""};
+    char *content = NULL;
+    char *prompted = NULL;
+    int *cwd = process != NULL ? &process->currentDirectory : &os->currentDirectory;
+
+    /* Parse the command; words may be of any length */
+    char *line = strdup(command);
+    if (line == NULL)
+    {
+        printf("Out of memory\n");
+        return;
+    }
 
-    /* Parse the command */
-    if (sscanf(command, "%s %s %s", cmd, arg1, arg2) < 1)
+    int argc = 0;
+    char *save;
+    for (char *word = strtok_r(line, " \t", &save); word != NULL && argc < 4; word = strtok_r(NULL, " \t", &save))
+    {
+        words[argc++] = word;
+    }
+    if (argc < 1)
     {
+        free(line);
         return;
     }
+    char *cmd = words[0];
+    char *arg1 = words[1];
+    char *arg2 = words[2];
+    char *arg3 = words[3];
+
+    /* write takes its content inline ("write file text") or, in the shell, from a prompt */
+    if (strcmp(cmd, "write") == 0)
+    {
+        int offset = 0;
+        size_t capacity = 0;
+
+        sscanf(command, "%*s %*s %n", &offset);
+        if (offset > 0 && command[offset] != '\0')
+        {
+            content = command + offset;
+        }
+        else if (process == NULL)
+        {
+            printf("Enter content: ");
+            if (getline(&prompted, &capacity, stdin) != -1)
+            {
+                prompted[strcspn(prompted, "\n")] = 0;
+                content = prompted;
+            }
+        }
+        if (content == NULL)
+        {
+            content = "";
+        }
+    }
+
+    if (isReadOnlyCommand(cmd))
+    {
+        pthread_rwlock_rdlock(&os->lock);
+    }
+    else
+    {
+        pthread_rwlock_wrlock(&os->lock);
+    }
 
     /* Handle commands */
     if (strcmp(cmd, "list") == 0 || strcmp(cmd, "ls") == 0)
     {
-        listFiles(os);
+        /* ls [order] [page size] [cursor] */
+        SortOrder order = SORT_NAME;
+        if (argc < 2 || strcmp(arg1, "name") == 0)
+        {
+            order = SORT_NAME;
+        }
+        else if (strcmp(arg1, "size") == 0)
+        {
+            order = SORT_SIZE;
+        }
+        else if (strcmp(arg1, "type") == 0)
+        {
+            order = SORT_TYPE;
+        }
+        else
+        {
+            order = SORT_ORDERS;
+            printf("Usage: ls [name|size|type] [page size] [cursor]\n");
+        }
+
+        if (order != SORT_ORDERS)
+        {
+            listFiles(os, *cwd, order, argc >= 3 ? atoi(arg2) : 0, argc >= 4 ? arg3 : NULL);
+        }
     }
     else if (strcmp(cmd, "move") == 0 || strcmp(cmd, "mv") == 0)
     {
-        moveFile(os, arg1, arg2);
+        moveFile(os, *cwd, arg1, arg2);
     }
     else if (strcmp(cmd, "rename") == 0)
     {
-        renameFile(os, arg1, arg2);
+        renameFile(os, *cwd, arg1, arg2);
     }
     else if (strcmp(cmd, "delete") == 0 || strcmp(cmd, "rm") == 0)
     {
-        deleteFile(os, arg1);
+        deleteFile(os, *cwd, arg1);
     }
     else if (strcmp(cmd, "rmdir") == 0)
     {
-        removeDirectory(os, arg1);
+        removeDirectory(os, *cwd, arg1);
     }
     else if (strcmp(cmd, "create") == 0)
     {
-        createFile(os, arg1);
+        createFile(os, *cwd, arg1);
     }
     else if (strcmp(cmd, "write") == 0)
     {
-        char content[1024];
-        printf("Enter content: ");
-        fgets(content, sizeof(content), stdin);
-        content[strcspn(content, "\n")] = 0;
-        writeToFile(os, arg1, content);
+        writeToFile(os, *cwd, arg1, content);
     }
     else if (strcmp(cmd, "read") == 0 || strcmp(cmd, "cat") == 0)
     {
-        readFile(os, arg1);
+        readFile(os, *cwd, arg1);
     }
     else if (strcmp(cmd, "mkdir") == 0)
     {
-        makeDirectory(os, arg1);
+        makeDirectory(os, *cwd, arg1);
     }
     else if (strcmp(cmd, "cd") == 0)
     {
-        changeDirectory(os, arg1);
+        changeDirectory(os, cwd, arg1);
     }
     else if (strcmp(cmd, "chmod") == 0)
     {
         int permissions = atoi(arg2);
-        setPermissions(os, arg1, permissions);
+        setPermissions(os, *cwd, arg1, permissions);
     }
     else if (strcmp(cmd, "copy") == 0 || strcmp(cmd, "cp") == 0)
     {
-        copyFile(os, arg1, arg2);
+        copyFile(os, *cwd, arg1, arg2);
+    }
+    else if (strcmp(cmd, "du") == 0)
+    {
+        diskUsage(os, *cwd, argc >= 2 ? arg1 : ".");
+    }
+    else if (strcmp(cmd, "quota") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Usage: quota [dirname] [bytes] [entries]\n");
+        }
+        else
+        {
+            setQuota(os, *cwd, arg1, atol(arg2), argc >= 4 ? atoi(arg3) : 0);
+        }
+    }
+    else if (strcmp(cmd, "run") == 0)
+    {
+        runScript(os, *cwd, arg1);
+    }
+    else if (strcmp(cmd, "ps") == 0)
+    {
+        listProcesses(os);
+    }
+    else if (strcmp(cmd, "kill") == 0)
+    {
+        killProcess(os, atoi(arg1));
+    }
+    else if (strcmp(cmd, "watch") == 0)
+    {
+        watchPath(os, *cwd, argc >= 2 ? arg1 : ".");
+    }
+    else if (strcmp(cmd, "unwatch") == 0)
+    {
+        unwatchPath(os, atoi(arg1));
+    }
+    else if (strcmp(cmd, "import") == 0)
+    {
+        if (argc < 2)
+        {
+            printf("Usage: import [hostdir] [dirname]\n");
+        }
+        else
+        {
+            importTree(os, *cwd, arg1, argc >= 3 ? arg2 : ".");
+        }
+    }
+    else if (strcmp(cmd, "export") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Usage: export [dirname] [hostdir]\n");
+        }
+        else
+        {
+            exportTree(os, *cwd, arg1, arg2);
+        }
     }
     else if (strcmp(cmd, "help") == 0)
     {
@@ -195,593 +729,2291 @@ void processCommand(OSState *os, char *command)
     }
     else if (strcmp(cmd, "exit") == 0 || strcmp(cmd, "quit") == 0)
     {
-        os->running = false;
+        if (process != NULL)
+        {
+            /* Ends the script, not the OS */
+            process->exitRequested = true;
+        }
+        else
+        {
+            os->running = false;
+        }
     }
     else
     {
         printf("Unknown command: %s\n", cmd);
     }
+
+    pthread_rwlock_unlock(&os->lock);
+    free(prompted);
+    free(line);
 }
 
-void listFiles(OSState *os)
+/* List one page of the working directory in the given order.
+ * The cursor printed after a partial page resumes right after its last
+ * entry, found by binary search rather than by re-scanning the directory.
+ */
+void listFiles(OSState *os, int cwd, SortOrder order, int pageSize, char *cursor)
 {
-    printf("Files in %s:\n", os->currentDirectory);
-    for (int i = 0; i < os->fileCount; i++)
+    static const char orderNames[SORT_ORDERS] = {'n', 's', 't'};
+    static const char *orderWords[SORT_ORDERS] = {"name", "size", "type"};
+
+    File *dir = &os->files[cwd];
+    if (!dir->exists)
+    {
+        printf("Current directory no longer exists\n");
+        return;
+    }
+    int start = 0;
+    if (cursor != NULL)
     {
-        if (os->files[i].exists)
+        /* Cursor layout: order, type, size, index and name of the last entry shown */
+        char orderName;
+        int isDirectory;
+        int offset = 0;
+        ListKey key;
+
+        if (sscanf(cursor, "%c%d.%ld.%d.%n", &orderName, &isDirectory, &key.size, &key.index, &offset) != 4 ||
+            offset == 0 || orderName != orderNames[order])
         {
-            /* Check if file is in current directory */
-            char *filename = os->files[i].name;
-            char *lastSlash = strrchr(filename, '/');
-
-            /* Handle files in root directory */
-            if (strcmp(os->currentDirectory, "/") == 0)
-            {
-                /* Show only files directly in root, not in subdirectories */
-                if (lastSlash == filename && strlen(filename) > 1)
-                {
-                    /* Skip files in subdirectories */
-                    continue;
-                }
-            }
-            else
-            {
-                /* For non-root directories, check if file is in current directory */
-                char dirPath[MAX_FILENAME_LENGTH];
-                sprintf(dirPath, "%s/", os->currentDirectory);
-
-                /* Skip files not in this directory */
-                if (strncmp(filename, dirPath, strlen(dirPath)) != 0 ||
-                    strchr(filename + strlen(dirPath), '/') != NULL)
-                {
-                    continue;
-                }
-            }
-
-            char permStr[4] = "---";
-            if (os->files[i].permissions & 4)
-                permStr[0] = 'r';
-            if (os->files[i].permissions & 2)
-                permStr[1] = 'w';
-            if (os->files[i].permissions & 1)
-                permStr[2] = 'x';
-
-            /* Display just the filename, not the full path */
-            char displayName[MAX_FILENAME_LENGTH];
-            if (lastSlash != NULL)
-            {
-                strcpy(displayName, lastSlash + 1);
-            }
-            else
-            {
-                strcpy(displayName, filename);
-            }
-
-            printf("  %s %s%s\n", permStr,
-                   os->files[i].isDirectory ? "[DIR] " : "",
-                   displayName);
+            printf("Invalid cursor: %s\n", cursor);
+            return;
         }
+        key.isDirectory = isDirectory != 0;
+        key.name = cursor + offset;
+        start = findListPosition(os, cwd, order, &key, true);
     }
-}
 
-void moveFile(OSState *os, char *source, char *destination)
-{
-    int sourceIndex = -1;
-    int destDirIndex = -1;
+    int end = dir->childCount;
+    if (pageSize > 0 && start + pageSize < end)
+    {
+        end = start + pageSize;
+    }
 
-    /* Find the source file */
-    for (int i = 0; i < os->fileCount; i++)
+    if (cursor == NULL)
+    {
+        char *path = entryPath(os, cwd);
+        printf("Files in %s:\n", path);
+        free(path);
+    }
+    for (int i = start; i < end; i++)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, source) == 0)
+        File *file = &os->files[dir->children[order][i]];
+
+        char permStr[4] = "---";
+        if (file->permissions & 4)
+            permStr[0] = 'r';
+        if (file->permissions & 2)
+            permStr[1] = 'w';
+        if (file->permissions & 1)
+            permStr[2] = 'x';
+
+        /* Display just the filename, not the full path */
+        if (order == SORT_SIZE)
         {
-            sourceIndex = i;
-            break;
+            printf("  %s %8ld %s%s\n", permStr, file->size,
+                   file->isDirectory ? "[DIR] " : "", nameText(&os->names, file->nameId));
+        }
+        else
+        {
+            printf("  %s %s%s\n", permStr,
+                   file->isDirectory ? "[DIR] " : "", nameText(&os->names, file->nameId));
         }
     }
 
+    if (end < dir->childCount)
+    {
+        ListKey last = entryKey(os, dir->children[order][end - 1]);
+        printf("More entries: ls %s %d %c%d.%ld.%d.%s\n", orderWords[order], pageSize,
+               orderNames[order], last.isDirectory, last.size, last.index, last.name);
+    }
+}
+
+void moveFile(OSState *os, int cwd, char *source, char *destination)
+{
+    int sourceIndex = resolvePath(os, cwd, source);
     if (sourceIndex == -1)
     {
         printf("File not found: %s\n", source);
         return;
     }
 
-    /* Check if destination exists and is a directory */
-    for (int i = 0; i < os->fileCount; i++)
+    if (sourceIndex == 0)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, destination) == 0)
-        {
-            if (os->files[i].isDirectory)
-            {
-                destDirIndex = i;
-            }
-            else
-            {
-                printf("Destination exists and is not a directory: %s\n", destination);
-                return;
-            }
-            break;
-        }
+        printf("Cannot move the root directory\n");
+        return;
     }
 
-    /* Create a new file at the destination */
-    if (os->fileCount >= MAX_FILES)
+    /* Check if destination exists and is a directory */
+    int newParent = resolvePath(os, cwd, destination);
+    int newNameId = os->files[sourceIndex].nameId;
+    if (newParent != -1 && !os->files[newParent].isDirectory)
     {
-        printf("Cannot move file: maximum number of files reached\n");
+        printf("Destination exists and is not a directory: %s\n", destination);
         return;
     }
 
-    /* Create the new file with the same content */
-    char newName[MAX_FILENAME_LENGTH];
-    if (destDirIndex != -1)
-    {
-        /* Move to directory */
-        sprintf(newName, "%s/%s", destination, source);
-    }
-    else
+    if (newParent == -1)
     {
         /* Rename */
-        strcpy(newName, destination);
+        char *leaf;
+        size_t leafLength;
+        newParent = resolveParent(os, cwd, destination, &leaf, &leafLength);
+        if (newParent == -1)
+        {
+            printf("Invalid path: %s\n", destination);
+            return;
+        }
+        newNameId = internName(&os->names, leaf, leafLength);
     }
 
-    strcpy(os->files[os->fileCount].name, newName);
-    strcpy(os->files[os->fileCount].content, os->files[sourceIndex].content);
-    os->files[os->fileCount].exists = true;
-    os->files[os->fileCount].isDirectory = os->files[sourceIndex].isDirectory;
-    os->files[os->fileCount].permissions = os->files[sourceIndex].permissions;
-    os->fileCount++;
-
-    /* Mark the original as deleted */
-    os->files[sourceIndex].exists = false;
-
-    printf("Moved %s to %s\n", source, newName);
+    int oldParent = os->files[sourceIndex].parent;
+    SharedPath *oldPath = os->watcherCount > 0 ? sharePath(os, sourceIndex) : NULL;
+    if (relocateEntry(os, sourceIndex, newParent, newNameId))
+    {
+        char *newName = entryPath(os, sourceIndex);
+        printf("Moved %s to %s\n", source, newName);
+        free(newName);
+        publishEvent(os, EVENT_MOVE, sourceIndex, oldParent, oldPath);
+    }
+    releasePath(oldPath);
 }
 
-void renameFile(OSState *os, char *oldname, char *newname)
+void renameFile(OSState *os, int cwd, char *oldname, char *newname)
 {
-    int fileIndex = -1;
+    int fileIndex = resolvePath(os, cwd, oldname);
+    if (fileIndex == -1)
+    {
+        printf("File not found: %s\n", oldname);
+        return;
+    }
 
-    /* Find the file */
-    for (int i = 0; i < os->fileCount; i++)
+    if (fileIndex == 0)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, oldname) == 0)
-        {
-            fileIndex = i;
-            break;
-        }
+        printf("Cannot rename the root directory\n");
+        return;
     }
 
-    if (fileIndex == -1)
+    /* A bare name stays in the same directory; a path moves the entry */
+    int newParent = os->files[fileIndex].parent;
+    char *leaf = newname;
+    size_t leafLength = strlen(newname);
+    if (strchr(newname, '/') != NULL)
     {
-        printf("File not found: %s\n", oldname);
+        newParent = resolveParent(os, cwd, newname, &leaf, &leafLength);
+    }
+
+    if (newParent == -1 || leafLength == 0 || strcmp(newname, ".") == 0 || strcmp(newname, "..") == 0)
+    {
+        printf("Invalid path: %s\n", newname);
         return;
     }
 
     /* Rename the file */
-    strcpy(os->files[fileIndex].name, newname);
-    printf("Renamed %s to %s\n", oldname, newname);
+    int oldParent = os->files[fileIndex].parent;
+    SharedPath *oldPath = os->watcherCount > 0 ? sharePath(os, fileIndex) : NULL;
+    if (relocateEntry(os, fileIndex, newParent, internName(&os->names, leaf, leafLength)))
+    {
+        printf("Renamed %s to %s\n", oldname, newname);
+        publishEvent(os, EVENT_RENAME, fileIndex, oldParent, oldPath);
+    }
+    releasePath(oldPath);
 }
 
-void deleteFile(OSState *os, char *filename)
+void deleteFile(OSState *os, int cwd, char *filename)
 {
-    int fileIndex = -1;
+    int fileIndex = resolvePath(os, cwd, filename);
+    if (fileIndex == -1)
+    {
+        printf("File not found: %s\n", filename);
+        return;
+    }
 
-    /* Find the file */
-    for (int i = 0; i < os->fileCount; i++)
+    if (fileIndex == 0)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, filename) == 0)
-        {
-            fileIndex = i;
-            break;
-        }
+        printf("Cannot delete the root directory\n");
+        return;
     }
 
-    if (fileIndex == -1)
+    /* Entries inside a directory would outlive it */
+    if (os->files[fileIndex].isDirectory && !isDirectoryEmpty(os, fileIndex))
     {
-        printf("File not found: %s\n", filename);
+        printf("Cannot delete directory: %s is not empty\n", filename);
         return;
     }
 
     /* Mark the file as deleted */
-    os->files[fileIndex].exists = false;
+    File *file = &os->files[fileIndex];
+    updateUsage(os, file->parent, -(file->size + file->usedBytes), -(1 + file->usedEntries));
+    unlinkChild(os, fileIndex);
+    file->exists = false;
+    free(file->content);
+    file->content = NULL;
     printf("Deleted %s\n", filename);
+    publishEvent(os, EVENT_DELETE, fileIndex, -1, NULL);
 }
 
-void createFile(OSState *os, char *filename)
+void createFile(OSState *os, int cwd, char *filename)
 {
-    if (os->fileCount >= MAX_FILES)
+    char *leaf;
+    size_t leafLength;
+    int parent = resolveParent(os, cwd, filename, &leaf, &leafLength);
+    if (parent == -1)
     {
-        printf("Cannot create file: maximum number of files reached\n");
+        printf("Invalid path: %s\n", filename);
         return;
     }
 
     /* Check if file already exists */
-    for (int i = 0; i < os->fileCount; i++)
+    int nameId = lookupName(&os->names, leaf, leafLength);
+    if (nameId != -1 && findChild(os, parent, nameId) != -1)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, filename) == 0)
-        {
-            printf("File already exists: %s\n", filename);
-            return;
-        }
+        printf("File already exists: %s\n", filename);
+        return;
     }
 
-    /* Create new file */
-    strcpy(os->files[os->fileCount].name, filename);
-    os->files[os->fileCount].content[0] = '\0';
-    os->files[os->fileCount].exists = true;
-    os->files[os->fileCount].isDirectory = false;
-    os->files[os->fileCount].permissions = 6; /* rw- by default */
-    os->fileCount++;
+    if (!checkQuota(os, parent, -1, 0, 1))
+    {
+        return;
+    }
 
+    /* Create new file */
+    int fileIndex = createEntry(os, parent, internName(&os->names, leaf, leafLength), false, 6); /* rw- by default */
     printf("Created file: %s\n", filename);
+    publishEvent(os, EVENT_CREATE, fileIndex, -1, NULL);
 }
 
-void writeToFile(OSState *os, char *filename, char *content)
+void writeToFile(OSState *os, int cwd, char *filename, char *content)
 {
-    int fileIndex = -1;
+    int fileIndex = resolvePath(os, cwd, filename);
+    if (fileIndex == -1)
+    {
+        printf("File not found: %s\n", filename);
+        return;
+    }
 
-    /* Find the file */
-    for (int i = 0; i < os->fileCount; i++)
+    File *file = &os->files[fileIndex];
+    long newSize = strlen(content);
+    if (!checkQuota(os, file->parent, -1, newSize - file->size, 0))
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, filename) == 0)
-        {
-            fileIndex = i;
-            break;
-        }
+        return;
     }
 
+    /* Write to the file */
+    storeContent(os, fileIndex, content, newSize);
+    printf("Content written to %s\n", filename);
+    publishEvent(os, EVENT_WRITE, fileIndex, -1, NULL);
+}
+
+void readFile(OSState *os, int cwd, char *filename)
+{
+    int fileIndex = resolvePath(os, cwd, filename);
     if (fileIndex == -1)
     {
         printf("File not found: %s\n", filename);
         return;
     }
 
-    /* Write to the file */
-    strcpy(os->files[fileIndex].content, content);
-    printf("Content written to %s\n", filename);
+    /* Display the file content */
+    char *content = os->files[fileIndex].content;
+    printf("Content of %s:\n%s\n", filename, content != NULL ? content : "");
 }
 
-void readFile(OSState *os, char *filename)
+void makeDirectory(OSState *os, int cwd, char *dirname)
 {
-    int fileIndex = -1;
+    /* Relative paths start at the current directory */
+    char *leaf;
+    size_t leafLength;
+    int parent = resolveParent(os, cwd, dirname, &leaf, &leafLength);
+    if (parent == -1)
+    {
+        printf("Invalid path: %s\n", dirname);
+        return;
+    }
 
-    /* Find the file */
-    for (int i = 0; i < os->fileCount; i++)
+    /* Check if directory already exists */
+    int nameId = lookupName(&os->names, leaf, leafLength);
+    if (nameId != -1 && findChild(os, parent, nameId) != -1)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, filename) == 0)
-        {
-            fileIndex = i;
-            break;
-        }
+        printf("Directory/file already exists: %s\n", dirname);
+        return;
     }
 
-    if (fileIndex == -1)
+    if (!checkQuota(os, parent, -1, 0, 1))
     {
-        printf("File not found: %s\n", filename);
         return;
     }
 
-    /* Display the file content */
-    printf("Content of %s:\n%s\n", filename, os->files[fileIndex].content);
+    /* Create new directory */
+    int dirIndex = createEntry(os, parent, internName(&os->names, leaf, leafLength), true, 7); /* rwx by default for directories */
+    printf("Created directory: %s\n", dirname);
+    publishEvent(os, EVENT_MKDIR, dirIndex, -1, NULL);
 }
 
-void makeDirectory(OSState *os, char *dirname)
+void changeDirectory(OSState *os, int *cwd, char *dirname)
 {
-    if (os->fileCount >= MAX_FILES)
+    /* "/", ".." and nested paths are all handled by path resolution */
+    int dirIndex = resolvePath(os, *cwd, dirname);
+    if (dirIndex == -1)
     {
-        printf("Cannot create directory: maximum number of files reached\n");
+        printf("Directory not found: %s\n", dirname);
         return;
     }
 
-    /* Handle special case for absolute path */
-    char fullPath[MAX_FILENAME_LENGTH];
-    if (dirname[0] == '/')
+    if (!os->files[dirIndex].isDirectory)
     {
-        /* Absolute path */
-        strcpy(fullPath, dirname);
+        printf("%s is not a directory\n", dirname);
+        return;
     }
-    else
+
+    /* Change to the directory */
+    *cwd = dirIndex;
+}
+
+void setPermissions(OSState *os, int cwd, char *filename, int permissions)
+{
+    /* Find the file */
+    int fileIndex = resolvePath(os, cwd, filename);
+    if (fileIndex == -1)
     {
-        /* Relative path - combine with current directory */
-        if (strcmp(os->currentDirectory, "/") == 0)
-        {
-            sprintf(fullPath, "/%s", dirname);
-        }
-        else
-        {
-            sprintf(fullPath, "%s/%s", os->currentDirectory, dirname);
-        }
+        printf("File not found: %s\n", filename);
+        return;
     }
 
-    /* Check if directory already exists */
-    for (int i = 0; i < os->fileCount; i++)
+    /* Check if permissions are valid (0-7) */
+    if (permissions < 0 || permissions > 7)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, fullPath) == 0)
-        {
-            printf("Directory/file already exists: %s\n", fullPath);
-            return;
-        }
+        printf("Invalid permissions: %d (must be 0-7)\n", permissions);
+        return;
     }
 
-    /* Create new directory */
-    strcpy(os->files[os->fileCount].name, fullPath);
-    os->files[os->fileCount].content[0] = '\0';
-    os->files[os->fileCount].exists = true;
-    os->files[os->fileCount].isDirectory = true;
-    os->files[os->fileCount].permissions = 7; /* rwx by default for directories */
-    os->fileCount++;
-
-    printf("Created directory: %s\n", fullPath);
+    /* Set the permissions */
+    os->files[fileIndex].permissions = permissions;
+    printf("Changed permissions of %s to %d\n", filename, permissions);
+    publishEvent(os, EVENT_CHMOD, fileIndex, -1, NULL);
 }
 
-void changeDirectory(OSState *os, char *dirname)
+void copyFile(OSState *os, int cwd, char *source, char *destination)
 {
-    /* Handle special case for root */
-    if (strcmp(dirname, "/") == 0)
+    int sourceIndex = resolvePath(os, cwd, source);
+    if (sourceIndex == -1)
     {
-        strcpy(os->currentDirectory, "/");
+        printf("File not found: %s\n", source);
         return;
     }
 
-    /* Handle special case for parent directory */
-    if (strcmp(dirname, "..") == 0)
+    if (sourceIndex == 0)
     {
-        /* Find the last slash in the current path */
-        char *lastSlash = strrchr(os->currentDirectory, '/');
-        if (lastSlash != NULL && lastSlash != os->currentDirectory)
-        {
-            /* Truncate the path at the last slash */
-            *lastSlash = '\0';
-        }
-        else
-        {
-            /* Already at root */
-            strcpy(os->currentDirectory, "/");
-        }
+        printf("Cannot copy the root directory\n");
         return;
     }
 
-    /* Find the directory */
-    int dirIndex = -1;
-    for (int i = 0; i < os->fileCount; i++)
+    /* Check if destination exists and is a directory */
+    int parent = resolvePath(os, cwd, destination);
+    int nameId = os->files[sourceIndex].nameId;
+    if (parent != -1 && !os->files[parent].isDirectory)
+    {
+        printf("Destination exists and is not a directory: %s\n", destination);
+        return;
+    }
+
+    if (parent == -1)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, dirname) == 0)
+        /* Copy with new name */
+        char *leaf;
+        size_t leafLength;
+        parent = resolveParent(os, cwd, destination, &leaf, &leafLength);
+        if (parent == -1)
         {
-            if (os->files[i].isDirectory)
-            {
-                dirIndex = i;
-                break;
-            }
-            else
-            {
-                printf("%s is not a directory\n", dirname);
-                return;
-            }
+            printf("Invalid path: %s\n", destination);
+            return;
         }
+        nameId = internName(&os->names, leaf, leafLength);
     }
 
-    if (dirIndex == -1)
+    /* Check if destination file already exists */
+    int existing = findChild(os, parent, nameId);
+    if (existing != -1)
     {
-        printf("Directory not found: %s\n", dirname);
+        char *path = entryPath(os, existing);
+        printf("Destination file already exists: %s\n", path);
+        free(path);
         return;
     }
 
-    /* Change to the directory */
-    if (strcmp(os->currentDirectory, "/") == 0)
-    {
-        sprintf(os->currentDirectory, "/%s", dirname);
-    }
-    else
+    /* Only the entry itself is copied, not a directory's children */
+    if (!checkQuota(os, parent, -1, os->files[sourceIndex].size, 1))
     {
-        sprintf(os->currentDirectory, "%s/%s", os->currentDirectory, dirname);
+        return;
     }
+
+    int newIndex = createEntry(os, parent, nameId, os->files[sourceIndex].isDirectory,
+                               os->files[sourceIndex].permissions);
+    storeContent(os, newIndex, os->files[sourceIndex].content, os->files[sourceIndex].size);
+
+    char *newName = entryPath(os, newIndex);
+    printf("Copied %s to %s\n", source, newName);
+    free(newName);
+    publishEvent(os, EVENT_CREATE, newIndex, -1, NULL);
 }
 
-void setPermissions(OSState *os, char *filename, int permissions)
+/* Check if a directory is empty */
+bool isDirectoryEmpty(OSState *os, int dirIndex)
 {
-    /* Find the file */
-    int fileIndex = -1;
-    for (int i = 0; i < os->fileCount; i++)
+    return os->files[dirIndex].childCount == 0;
+}
+
+/* Remove a directory if it's empty */
+void removeDirectory(OSState *os, int cwd, char *dirname)
+{
+    /* Find the directory; relative paths start at the current directory */
+    int dirIndex = resolvePath(os, cwd, dirname);
+    if (dirIndex == -1)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, filename) == 0)
-        {
-            fileIndex = i;
-            break;
-        }
+        printf("Directory not found: %s\n", dirname);
+        return;
     }
 
-    if (fileIndex == -1)
+    /* Check if it's a directory */
+    if (!os->files[dirIndex].isDirectory)
     {
-        printf("File not found: %s\n", filename);
+        printf("%s is not a directory\n", dirname);
         return;
     }
 
-    /* Check if permissions are valid (0-7) */
-    if (permissions < 0 || permissions > 7)
+    if (dirIndex == 0)
     {
-        printf("Invalid permissions: %d (must be 0-7)\n", permissions);
+        printf("Cannot remove the root directory\n");
         return;
     }
 
-    /* Set the permissions */
-    os->files[fileIndex].permissions = permissions;
-    printf("Changed permissions of %s to %d\n", filename, permissions);
+    /* Check if the directory is empty */
+    if (!isDirectoryEmpty(os, dirIndex))
+    {
+        printf("Cannot remove directory: %s is not empty\n", dirname);
+        return;
+    }
+
+    /* Mark the directory as deleted */
+    File *dir = &os->files[dirIndex];
+    updateUsage(os, dir->parent, -(dir->size + dir->usedBytes), -(1 + dir->usedEntries));
+    unlinkChild(os, dirIndex);
+    dir->exists = false;
+    printf("Removed directory: %s\n", dirname);
+    publishEvent(os, EVENT_RMDIR, dirIndex, -1, NULL);
 }
 
-void copyFile(OSState *os, char *source, char *destination)
+/* FNV-1a hash of a path component */
+unsigned int hashName(const char *name, size_t length)
 {
-    int sourceIndex = -1;
-    int destDirIndex = -1;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
 
-    /* Find the source file */
-    for (int i = 0; i < os->fileCount; i++)
+/* Find the ID of an already interned component, -1 if there is none */
+int lookupName(NameTable *names, const char *name, size_t length)
+{
+    if (names->slotCount == 0)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, source) == 0)
+        return -1;
+    }
+
+    unsigned int mask = names->slotCount - 1;
+    for (unsigned int i = hashName(name, length) & mask;; i = (i + 1) & mask)
+    {
+        int nameId = names->slots[i];
+        if (nameId == -1)
         {
-            sourceIndex = i;
-            break;
+            return -1;
+        }
+
+        char *text = names->text + names->offsets[nameId];
+        if (strncmp(text, name, length) == 0 && text[length] == '\0')
+        {
+            return nameId;
         }
     }
+}
 
-    if (sourceIndex == -1)
+/* Return the ID of a component, adding it to the arena the first time it is seen */
+int internName(NameTable *names, const char *name, size_t length)
+{
+    int nameId = lookupName(names, name, length);
+    if (nameId != -1)
     {
-        printf("File not found: %s\n", source);
-        return;
+        return nameId;
     }
 
-    /* Check if destination exists and is a directory */
-    for (int i = 0; i < os->fileCount; i++)
+    /* Keep the hash at most half full */
+    if ((names->count + 1) * 2 > names->slotCount)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, destination) == 0)
+        int slotCount = names->slotCount == 0 ? 64 : names->slotCount * 2;
+        names->slots = reallocOrExit(names->slots, slotCount * sizeof(int));
+        names->slotCount = slotCount;
+        for (int i = 0; i < slotCount; i++)
         {
-            if (os->files[i].isDirectory)
-            {
-                destDirIndex = i;
-            }
-            else
+            names->slots[i] = -1;
+        }
+
+        for (int id = 0; id < names->count; id++)
+        {
+            char *text = names->text + names->offsets[id];
+            unsigned int i = hashName(text, strlen(text)) & (slotCount - 1);
+            while (names->slots[i] != -1)
             {
-                printf("Destination exists and is not a directory: %s\n", destination);
-                return;
+                i = (i + 1) & (slotCount - 1);
             }
-            break;
+            names->slots[i] = id;
         }
     }
 
-    /* Create a new file at the destination */
-    if (os->fileCount >= MAX_FILES)
+    if (names->textSize + length + 1 > names->textCapacity)
     {
-        printf("Cannot copy file: maximum number of files reached\n");
-        return;
+        size_t capacity = names->textCapacity == 0 ? 4096 : names->textCapacity * 2;
+        while (capacity < names->textSize + length + 1)
+        {
+            capacity *= 2;
+        }
+        names->text = reallocOrExit(names->text, capacity);
+        names->textCapacity = capacity;
     }
 
-    /* Create the new file with the same content */
-    char newName[MAX_FILENAME_LENGTH];
-    if (destDirIndex != -1)
+    if (names->count == names->capacity)
     {
-        /* Copy to directory */
-        sprintf(newName, "%s/%s", destination, source);
+        names->capacity = names->capacity == 0 ? 64 : names->capacity * 2;
+        names->offsets = reallocOrExit(names->offsets, names->capacity * sizeof(size_t));
     }
-    else
+
+    nameId = names->count++;
+    names->offsets[nameId] = names->textSize;
+    memcpy(names->text + names->textSize, name, length);
+    names->text[names->textSize + length] = '\0';
+    names->textSize += length + 1;
+
+    unsigned int mask = names->slotCount - 1;
+    unsigned int i = hashName(name, length) & mask;
+    while (names->slots[i] != -1)
     {
-        /* Copy with new name */
-        strcpy(newName, destination);
+        i = (i + 1) & mask;
     }
+    names->slots[i] = nameId;
+    return nameId;
+}
 
-    /* Check if destination file already exists */
-    for (int i = 0; i < os->fileCount; i++)
+char *nameText(NameTable *names, int nameId)
+{
+    return names->text + names->offsets[nameId];
+}
+
+unsigned int hashEntry(int parent, int nameId)
+{
+    return (unsigned int)parent * 2654435761u ^ (unsigned int)nameId * 40503u;
+}
+
+/* Find the entry called nameId inside a directory, -1 if there is none */
+int findChild(OSState *os, int dirIndex, int nameId)
+{
+    if (os->entrySlotCount == 0)
+    {
+        return -1;
+    }
+
+    unsigned int mask = os->entrySlotCount - 1;
+    for (unsigned int i = hashEntry(dirIndex, nameId) & mask;; i = (i + 1) & mask)
     {
-        if (os->files[i].exists && strcmp(os->files[i].name, newName) == 0)
+        int index = os->entrySlots[i];
+        if (index == -1)
         {
-            printf("Destination file already exists: %s\n", newName);
-            return;
+            return -1;
+        }
+        if (os->files[index].parent == dirIndex && os->files[index].nameId == nameId)
+        {
+            return index;
         }
     }
-
-    strcpy(os->files[os->fileCount].name, newName);
-    strcpy(os->files[os->fileCount].content, os->files[sourceIndex].content);
-    os->files[os->fileCount].exists = true;
-    os->files[os->fileCount].isDirectory = os->files[sourceIndex].isDirectory;
-    os->files[os->fileCount].permissions = os->files[sourceIndex].permissions;
-    os->fileCount++;
-
-    printf("Copied %s to %s\n", source, newName);
 }
 
-/* Check if a directory is empty */
-bool isDirectoryEmpty(OSState *os, char *dirname)
+/* Add an entry to the (parent, nameId) hash */
+void addEntrySlot(OSState *os, int index)
 {
-    /* Check if any file or directory has this directory as its parent */
-    char dirPath[MAX_FILENAME_LENGTH];
+    if ((os->entrySlotsUsed + 1) * 2 > os->entrySlotCount)
+    {
+        int *oldSlots = os->entrySlots;
+        int oldCount = os->entrySlotCount;
+
+        os->entrySlotCount = oldCount == 0 ? 64 : oldCount * 2;
+        os->entrySlots = reallocOrExit(NULL, os->entrySlotCount * sizeof(int));
+        for (int i = 0; i < os->entrySlotCount; i++)
+        {
+            os->entrySlots[i] = -1;
+        }
+        os->entrySlotsUsed = 0;
+
+        for (int i = 0; i < oldCount; i++)
+        {
+            if (oldSlots[i] != -1)
+            {
+                addEntrySlot(os, oldSlots[i]);
+            }
+        }
+        free(oldSlots);
+    }
 
-    /* Ensure the directory path ends with a slash for proper prefix matching */
-    if (strcmp(dirname, "/") == 0)
+    unsigned int mask = os->entrySlotCount - 1;
+    unsigned int i = hashEntry(os->files[index].parent, os->files[index].nameId) & mask;
+    while (os->entrySlots[i] != -1)
     {
-        strcpy(dirPath, "/");
+        i = (i + 1) & mask;
     }
-    else
+    os->entrySlots[i] = index;
+    os->entrySlotsUsed++;
+}
+
+/* Remove an entry from the (parent, nameId) hash, shifting later probes back into the gap */
+void removeEntrySlot(OSState *os, int index)
+{
+    unsigned int mask = os->entrySlotCount - 1;
+    unsigned int i = hashEntry(os->files[index].parent, os->files[index].nameId) & mask;
+    while (os->entrySlots[i] != index)
     {
-        sprintf(dirPath, "%s/", dirname);
+        if (os->entrySlots[i] == -1)
+        {
+            return;
+        }
+        i = (i + 1) & mask;
     }
 
-    int dirPathLen = strlen(dirPath);
+    os->entrySlots[i] = -1;
+    os->entrySlotsUsed--;
 
-    for (int i = 0; i < os->fileCount; i++)
+    for (unsigned int j = (i + 1) & mask; os->entrySlots[j] != -1; j = (j + 1) & mask)
     {
-        if (os->files[i].exists &&
-            strncmp(os->files[i].name, dirPath, dirPathLen) == 0 &&
-            strcmp(os->files[i].name, dirname) != 0)
+        int moved = os->entrySlots[j];
+        unsigned int home = hashEntry(os->files[moved].parent, os->files[moved].nameId) & mask;
+
+        /* Move it back if its home slot is not between the gap and its current slot */
+        if (((j - home) & mask) >= ((j - i) & mask))
         {
-            /* Found a file/directory inside this directory */
-            return false;
+            os->entrySlots[i] = moved;
+            os->entrySlots[j] = -1;
+            i = j;
         }
     }
-
-    return true;
 }
 
-/* Remove a directory if it's empty */
-void removeDirectory(OSState *os, char *dirname)
+/* Resolve the first length bytes of a path; relative paths start at cwd */
+int resolvePrefix(OSState *os, int cwd, char *path, size_t length)
 {
-    int dirIndex = -1;
+    int current = length > 0 && path[0] == '/' ? 0 : cwd;
+    size_t position = 0;
 
-    /* Handle special case for absolute path */
-    char fullPath[MAX_FILENAME_LENGTH];
-    if (dirname[0] == '/')
+    if (!os->files[current].exists)
     {
-        /* Absolute path */
-        strcpy(fullPath, dirname);
+        return -1;
     }
-    else
+
+    while (position < length)
     {
-        /* Relative path - combine with current directory */
-        if (strcmp(os->currentDirectory, "/") == 0)
+        if (path[position] == '/')
         {
-            sprintf(fullPath, "/%s", dirname);
+            position++;
+            continue;
         }
-        else
+
+        char *component = path + position;
+        size_t componentLength = 0;
+        while (position < length && path[position] != '/')
         {
-            sprintf(fullPath, "%s/%s", os->currentDirectory, dirname);
+            position++;
+            componentLength++;
         }
-    }
 
-    /* Find the directory */
-    for (int i = 0; i < os->fileCount; i++)
-    {
-        if (os->files[i].exists && strcmp(os->files[i].name, fullPath) == 0)
+        if (componentLength == 1 && component[0] == '.')
         {
-            dirIndex = i;
-            break;
+            continue;
+        }
+        if (componentLength == 2 && component[0] == '.' && component[1] == '.')
+        {
+            if (os->files[current].parent != -1)
+            {
+                current = os->files[current].parent;
+            }
+            continue;
+        }
+
+        if (!os->files[current].isDirectory)
+        {
+            return -1;
+        }
+
+        int nameId = lookupName(&os->names, component, componentLength);
+        if (nameId == -1)
+        {
+            return -1;
+        }
+
+        current = findChild(os, current, nameId);
+        if (current == -1)
+        {
+            return -1;
         }
     }
 
-    if (dirIndex == -1)
+    return current;
+}
+
+/* Find the entry a path names, -1 if it does not exist */
+int resolvePath(OSState *os, int cwd, char *path)
+{
+    if (path[0] == '\0')
     {
-        printf("Directory not found: %s\n", fullPath);
-        return;
+        return -1;
     }
+    return resolvePrefix(os, cwd, path, strlen(path));
+}
 
-    /* Check if it's a directory */
-    if (!os->files[dirIndex].isDirectory)
+/* Find the directory a new entry at path would go in, and the new entry's name */
+int resolveParent(OSState *os, int cwd, char *path, char **leaf, size_t *leafLength)
+{
+    size_t length = strlen(path);
+    while (length > 1 && path[length - 1] == '/')
     {
-        printf("%s is not a directory\n", fullPath);
-        return;
+        length--;
     }
 
-    /* Check if the directory is empty */
-    if (!isDirectoryEmpty(os, fullPath))
+    size_t start = length;
+    while (start > 0 && path[start - 1] != '/')
     {
-        printf("Cannot remove directory: %s is not empty\n", fullPath);
-        return;
+        start--;
     }
 
-    /* Mark the directory as deleted */
-    os->files[dirIndex].exists = false;
-    printf("Removed directory: %s\n", fullPath);
+    *leaf = path + start;
+    *leafLength = length - start;
+    if (*leafLength == 0 || strncmp(*leaf, ".", *leafLength) == 0 || strncmp(*leaf, "..", *leafLength) == 0)
+    {
+        return -1;
+    }
+
+    int parent = resolvePrefix(os, cwd, path, start);
+    if (parent == -1 || !os->files[parent].isDirectory)
+    {
+        return -1;
+    }
+    return parent;
+}
+
+/* Build the absolute path of an entry; the caller frees it */
+char *entryPath(OSState *os, int index)
+{
+    size_t length = pathLength(os, index);
+    char *path = reallocOrExit(NULL, length + 1);
+    writePath(os, index, path, length);
+    return path;
+}
+
+/* Length of an entry's absolute path, without the terminator */
+size_t pathLength(OSState *os, int index)
+{
+    size_t length = 0;
+    for (int i = index; os->files[i].parent != -1; i = os->files[i].parent)
+    {
+        length += 1 + strlen(nameText(&os->names, os->files[i].nameId));
+    }
+    return length == 0 ? 1 : length;
+}
+
+/* Write an entry's absolute path into a buffer of length + 1 bytes */
+void writePath(OSState *os, int index, char *path, size_t length)
+{
+    path[length] = '\0';
+    if (os->files[index].parent == -1)
+    {
+        path[0] = '/';
+        return;
+    }
+
+    for (int i = index; os->files[i].parent != -1; i = os->files[i].parent)
+    {
+        char *name = nameText(&os->names, os->files[i].nameId);
+        size_t nameLength = strlen(name);
+
+        length -= nameLength;
+        memcpy(path + length, name, nameLength);
+        path[--length] = '/';
+    }
+}
+
+/* Build an entry's path for watchers, in a single allocation holding one reference */
+SharedPath *sharePath(OSState *os, int index)
+{
+    size_t length = pathLength(os, index);
+    SharedPath *path = reallocOrExit(NULL, sizeof(SharedPath) + length + 1);
+    atomic_init(&path->references, 1);
+    writePath(os, index, path->text, length);
+    return path;
+}
+
+void releasePath(SharedPath *path)
+{
+    if (path != NULL && atomic_fetch_sub(&path->references, 1) == 1)
+    {
+        free(path);
+    }
+}
+
+/* Add a new, empty entry to a directory */
+int createEntry(OSState *os, int parent, int nameId, bool isDirectory, int permissions)
+{
+    int index = allocateEntry(os, parent, nameId, isDirectory, permissions);
+    linkChild(os, index);
+    updateUsage(os, parent, 0, 1);
+    return index;
+}
+
+/* Take a slot for a new entry; the caller links it and accounts for it */
+int allocateEntry(OSState *os, int parent, int nameId, bool isDirectory, int permissions)
+{
+    if (os->fileCount == os->fileCapacity)
+    {
+        os->fileCapacity = os->fileCapacity == 0 ? 64 : os->fileCapacity * 2;
+        os->files = reallocOrExit(os->files, os->fileCapacity * sizeof(File));
+    }
+
+    int index = os->fileCount++;
+    initializeEntry(&os->files[index], nameId, isDirectory, permissions);
+    os->files[index].parent = parent;
+    return index;
+}
+
+/* Replace the content of an entry with a copy of size bytes */
+void storeContent(OSState *os, int index, const char *content, long size)
+{
+    char *copy = NULL;
+    if (size > 0)
+    {
+        copy = reallocOrExit(NULL, size + 1);
+        memcpy(copy, content, size);
+        copy[size] = '\0';
+    }
+
+    File *file = &os->files[index];
+    free(file->content);
+    file->content = copy;
+    updateUsage(os, file->parent, size - file->size, 0);
+    resizeEntry(os, index, size);
+}
+
+/* Move an entry, with its whole subtree, to a new parent and name */
+bool relocateEntry(OSState *os, int index, int newParent, int newNameId)
+{
+    int existing = findChild(os, newParent, newNameId);
+    if (existing != -1)
+    {
+        char *path = entryPath(os, existing);
+        printf("Destination file already exists: %s\n", path);
+        free(path);
+        return false;
+    }
+
+    if (isAncestor(os, index, newParent))
+    {
+        printf("Cannot move a directory into itself\n");
+        return false;
+    }
+
+    File *file = &os->files[index];
+    long bytes = file->size + file->usedBytes;
+    int entries = 1 + file->usedEntries;
+    if (!checkQuota(os, newParent, index, bytes, entries))
+    {
+        return false;
+    }
+
+    updateUsage(os, file->parent, -bytes, -entries);
+    unlinkChild(os, index);
+    file->parent = newParent;
+    file->nameId = newNameId;
+    linkChild(os, index);
+    updateUsage(os, newParent, bytes, entries);
+    return true;
+}
+
+/* Check whether ancestor is index itself or one of its parents */
+bool isAncestor(OSState *os, int ancestor, int index)
+{
+    for (int i = index; i != -1; i = os->files[i].parent)
+    {
+        if (i == ancestor)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Number of parents above an entry; the root has depth 0 */
+int entryDepth(OSState *os, int index)
+{
+    int depth = 0;
+    for (int i = os->files[index].parent; i != -1; i = os->files[i].parent)
+    {
+        depth++;
+    }
+    return depth;
+}
+
+/* Deepest directory containing both entries, -1 if they share none */
+int commonAncestor(OSState *os, int a, int b)
+{
+    int depthA = entryDepth(os, a);
+    int depthB = entryDepth(os, b);
+
+    for (; depthA > depthB; depthA--)
+    {
+        a = os->files[a].parent;
+    }
+    for (; depthB > depthA; depthB--)
+    {
+        b = os->files[b].parent;
+    }
+    while (a != b)
+    {
+        a = os->files[a].parent;
+        b = os->files[b].parent;
+    }
+    return a;
+}
+
+/* Check that adding bytes/entries under dirIndex keeps every enclosing quota.
+ * Directories that also contain skipShared are left out, since moving an
+ * entry within them does not change their totals.
+ */
+bool checkQuota(OSState *os, int dirIndex, int skipShared, long bytes, int entries)
+{
+    int shared = skipShared != -1 ? commonAncestor(os, dirIndex, skipShared) : -1;
+
+    for (int i = dirIndex; i != -1 && i != shared && os->files[i].exists; i = os->files[i].parent)
+    {
+        File *dir = &os->files[i];
+
+        if ((bytes > 0 && dir->quotaBytes > 0 && dir->usedBytes + bytes > dir->quotaBytes) ||
+            (entries > 0 && dir->quotaEntries > 0 && dir->usedEntries + entries > dir->quotaEntries))
+        {
+            char *path = entryPath(os, i);
+            printf("Quota exceeded for %s\n", path);
+            free(path);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Apply a change in usage to dirIndex and every directory above it */
+void updateUsage(OSState *os, int dirIndex, long bytes, int entries)
+{
+    for (int i = dirIndex; i != -1 && os->files[i].exists; i = os->files[i].parent)
+    {
+        os->files[i].usedBytes += bytes;
+        os->files[i].usedEntries += entries;
+    }
+}
+
+/* Report the space used by a file or directory */
+void diskUsage(OSState *os, int cwd, char *path)
+{
+    int fileIndex = resolvePath(os, cwd, path);
+    if (fileIndex == -1)
+    {
+        printf("File not found: %s\n", path);
+        return;
+    }
+
+    File *file = &os->files[fileIndex];
+    char *fullPath = entryPath(os, fileIndex);
+    if (!file->isDirectory)
+    {
+        printf("%ld bytes  %s\n", file->size, fullPath);
+    }
+    else
+    {
+        printf("%ld bytes, %d entries  %s\n", file->size + file->usedBytes, file->usedEntries, fullPath);
+        if (file->quotaBytes > 0 || file->quotaEntries > 0)
+        {
+            printf("  quota: %ld bytes, %d entries (0 = unlimited)\n", file->quotaBytes, file->quotaEntries);
+        }
+    }
+    free(fullPath);
+}
+
+/* Set the byte and entry limits of a directory */
+void setQuota(OSState *os, int cwd, char *dirname, long bytes, int entries)
+{
+    int dirIndex = resolvePath(os, cwd, dirname);
+    if (dirIndex == -1)
+    {
+        printf("Directory not found: %s\n", dirname);
+        return;
+    }
+
+    if (!os->files[dirIndex].isDirectory)
+    {
+        printf("%s is not a directory\n", dirname);
+        return;
+    }
+
+    if (bytes < 0 || entries < 0)
+    {
+        printf("Invalid quota: limits must not be negative\n");
+        return;
+    }
+
+    os->files[dirIndex].quotaBytes = bytes;
+    os->files[dirIndex].quotaEntries = entries;
+    printf("Set quota of %s to %ld bytes, %d entries\n", dirname, bytes, entries);
+}
+
+ListKey entryKey(OSState *os, int index)
+{
+    ListKey key;
+    key.isDirectory = os->files[index].isDirectory;
+    key.size = os->files[index].size;
+    key.index = index;
+    key.name = nameText(&os->names, os->files[index].nameId);
+    return key;
+}
+
+/* Total order of a listing; the entry index breaks ties between equal names */
+int compareKeys(SortOrder order, ListKey *a, ListKey *b)
+{
+    if (order == SORT_TYPE && a->isDirectory != b->isDirectory)
+    {
+        return a->isDirectory ? -1 : 1;
+    }
+    if (order == SORT_SIZE && a->size != b->size)
+    {
+        return a->size > b->size ? -1 : 1;
+    }
+
+    int result = strcmp(a->name, b->name);
+    if (result != 0)
+    {
+        return result;
+    }
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+/* Binary search for the first child at or (if after) past key */
+int findListPosition(OSState *os, int dirIndex, SortOrder order, ListKey *key, bool after)
+{
+    File *dir = &os->files[dirIndex];
+    int low = 0;
+    int high = dir->childCount;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        ListKey current = entryKey(os, dir->children[order][middle]);
+        int result = compareKeys(order, &current, key);
+
+        if (result < 0 || (after && result == 0))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void insertSorted(OSState *os, int dirIndex, SortOrder order, int index)
+{
+    File *dir = &os->files[dirIndex];
+    ListKey key = entryKey(os, index);
+    int position = findListPosition(os, dirIndex, order, &key, false);
+
+    memmove(&dir->children[order][position + 1], &dir->children[order][position],
+            (dir->childCount - position) * sizeof(int));
+    dir->children[order][position] = index;
+}
+
+void removeSorted(OSState *os, int dirIndex, SortOrder order, int index)
+{
+    File *dir = &os->files[dirIndex];
+    ListKey key = entryKey(os, index);
+    int position = findListPosition(os, dirIndex, order, &key, false);
+
+    if (position < dir->childCount && dir->children[order][position] == index)
+    {
+        memmove(&dir->children[order][position], &dir->children[order][position + 1],
+                (dir->childCount - position - 1) * sizeof(int));
+    }
+}
+
+/* Make room for one more child in every listing of a directory */
+void reserveChild(OSState *os, int dirIndex)
+{
+    File *dir = &os->files[dirIndex];
+    if (dir->childCount == dir->childCapacity)
+    {
+        int capacity = dir->childCapacity == 0 ? 8 : dir->childCapacity * 2;
+        for (int order = 0; order < SORT_ORDERS; order++)
+        {
+            dir->children[order] = reallocOrExit(dir->children[order], capacity * sizeof(int));
+        }
+        dir->childCapacity = capacity;
+    }
+}
+
+/* Add an entry to every sorted listing of its parent */
+void linkChild(OSState *os, int index)
+{
+    int dirIndex = os->files[index].parent;
+    if (dirIndex == -1)
+    {
+        return;
+    }
+
+    reserveChild(os, dirIndex);
+    for (int order = 0; order < SORT_ORDERS; order++)
+    {
+        insertSorted(os, dirIndex, order, index);
+    }
+    os->files[dirIndex].childCount++;
+    addEntrySlot(os, index);
+}
+
+/* Add an entry to the end of its parent's listings for bulk loads.
+ * The listings are out of order until sortChildren runs on the parent.
+ */
+void appendChild(OSState *os, int index)
+{
+    int dirIndex = os->files[index].parent;
+    reserveChild(os, dirIndex);
+
+    File *dir = &os->files[dirIndex];
+    for (int order = 0; order < SORT_ORDERS; order++)
+    {
+        dir->children[order][dir->childCount] = index;
+    }
+    dir->childCount++;
+    addEntrySlot(os, index);
+}
+
+/* qsort has no context argument; sorts only run under the write lock */
+static struct
+{
+    OSState *os;
+    SortOrder order;
+} sortContext;
+
+int compareSortContext(const void *a, const void *b)
+{
+    ListKey keyA = entryKey(sortContext.os, *(const int *)a);
+    ListKey keyB = entryKey(sortContext.os, *(const int *)b);
+    return compareKeys(sortContext.order, &keyA, &keyB);
+}
+
+/* Restore the order of every listing of a directory after appendChild */
+void sortChildren(OSState *os, int dirIndex)
+{
+    File *dir = &os->files[dirIndex];
+    if (dir->childCount < 2)
+    {
+        return;
+    }
+
+    sortContext.os = os;
+    for (int order = 0; order < SORT_ORDERS; order++)
+    {
+        sortContext.order = order;
+        qsort(dir->children[order], dir->childCount, sizeof(int), compareSortContext);
+    }
+}
+
+/* Change the size of an entry, moving it within its parent's size order */
+void resizeEntry(OSState *os, int index, long size)
+{
+    int dirIndex = os->files[index].parent;
+    if (dirIndex == -1)
+    {
+        os->files[index].size = size;
+        return;
+    }
+
+    File *dir = &os->files[dirIndex];
+    removeSorted(os, dirIndex, SORT_SIZE, index);
+    dir->childCount--;
+    os->files[index].size = size;
+    insertSorted(os, dirIndex, SORT_SIZE, index);
+    dir->childCount++;
+}
+
+/* Remove an entry from every sorted listing of its parent */
+void unlinkChild(OSState *os, int index)
+{
+    int dirIndex = os->files[index].parent;
+    if (dirIndex == -1)
+    {
+        return;
+    }
+
+    for (int order = 0; order < SORT_ORDERS; order++)
+    {
+        removeSorted(os, dirIndex, order, index);
+    }
+    os->files[dirIndex].childCount--;
+    removeEntrySlot(os, index);
+}
+
+/* Start a script as a new process in the caller's working directory */
+void runScript(OSState *os, int cwd, char *script)
+{
+    int fileIndex = resolvePath(os, cwd, script);
+    if (fileIndex == -1)
+    {
+        printf("File not found: %s\n", script);
+        return;
+    }
+
+    File *file = &os->files[fileIndex];
+    if (file->isDirectory)
+    {
+        printf("%s is not a script\n", script);
+        return;
+    }
+
+    if (!(file->permissions & 1))
+    {
+        printf("Permission denied: %s is not executable\n", script);
+        return;
+    }
+
+    char *commands = strdup(file->content != NULL ? file->content : "");
+    char *name = strdup(script);
+    if (commands == NULL || name == NULL)
+    {
+        free(commands);
+        free(name);
+        printf("Cannot run script: out of memory\n");
+        return;
+    }
+
+    /* Take a free slot; finished processes stay listed in ps until slots run
+     * out, and then the oldest finished one is recycled first
+     */
+    pthread_mutex_lock(&os->processLock);
+    if (os->shuttingDown)
+    {
+        pthread_mutex_unlock(&os->processLock);
+        free(commands);
+        free(name);
+        printf("Cannot run script: shutting down\n");
+        return;
+    }
+
+    Process *process = NULL;
+    for (int i = 0; i < MAX_PROCESSES; i++)
+    {
+        ProcessState state = os->processes[i].state;
+        if (state == PROCESS_FREE)
+        {
+            process = &os->processes[i];
+            break;
+        }
+        if ((state == PROCESS_EXITED || state == PROCESS_KILLED) &&
+            (process == NULL || os->processes[i].pid < process->pid))
+        {
+            process = &os->processes[i];
+        }
+    }
+
+    if (process == NULL)
+    {
+        pthread_mutex_unlock(&os->processLock);
+        free(commands);
+        free(name);
+        printf("Cannot run script: maximum number of processes reached\n");
+        return;
+    }
+
+    process->os = os;
+    process->pid = os->nextPid++;
+    process->state = PROCESS_READY;
+    process->killRequested = false;
+    process->exitRequested = false;
+    free(process->script);
+    process->script = name;
+    process->currentDirectory = cwd;
+    process->commands = commands;
+    process->nextCommand = commands;
+    process->commandsRun = 0;
+    int pid = process->pid;
+    pthread_mutex_unlock(&os->processLock);
+
+    printf("Started process %d: %s\n", pid, script);
+    submitTask(&os->scheduler, runProcessSlice, process);
+}
+
+/* Print the process table */
+void listProcesses(OSState *os)
+{
+    static const char *stateNames[] = {"free", "ready", "running", "exited", "killed"};
+
+    pthread_mutex_lock(&os->processLock);
+    printf("  PID  STATE    CMDS  CWD                  SCRIPT\n");
+    for (int i = 0; i < MAX_PROCESSES; i++)
+    {
+        Process *process = &os->processes[i];
+        if (process->state != PROCESS_FREE)
+        {
+            char *cwd = entryPath(os, process->currentDirectory);
+            printf("  %-4d %-8s %4d  %-20s %s\n", process->pid, stateNames[process->state],
+                   process->commandsRun, cwd, process->script);
+            free(cwd);
+        }
+    }
+    pthread_mutex_unlock(&os->processLock);
+}
+
+/* Ask a process to stop; it does so before its next command */
+void killProcess(OSState *os, int pid)
+{
+    pthread_mutex_lock(&os->processLock);
+    for (int i = 0; i < MAX_PROCESSES; i++)
+    {
+        Process *process = &os->processes[i];
+        if (process->state == PROCESS_FREE || process->pid != pid)
+        {
+            continue;
+        }
+
+        if (process->state == PROCESS_EXITED || process->state == PROCESS_KILLED)
+        {
+            printf("Process %d has already finished\n", pid);
+        }
+        else
+        {
+            process->killRequested = true;
+            printf("Killed process %d\n", pid);
+        }
+        pthread_mutex_unlock(&os->processLock);
+        return;
+    }
+    pthread_mutex_unlock(&os->processLock);
+
+    printf("No such process: %d\n", pid);
+}
+
+/* Run the next command of a process, then requeue it behind the other work */
+void runProcessSlice(void *arg)
+{
+    Process *process = arg;
+    OSState *os = process->os;
+
+    pthread_mutex_lock(&os->processLock);
+    bool killed = process->killRequested;
+    process->state = PROCESS_RUNNING;
+    pthread_mutex_unlock(&os->processLock);
+
+    /* Commands are separated by newlines or semicolons */
+    char *line = killed ? NULL : strtok_r(process->nextCommand, ";\n", &process->nextCommand);
+    if (line != NULL)
+    {
+        processCommand(os, process, line);
+    }
+
+    pthread_mutex_lock(&os->processLock);
+    if (line != NULL)
+    {
+        process->commandsRun++;
+    }
+
+    bool finished = line == NULL || process->exitRequested || process->killRequested;
+    if (finished)
+    {
+        free(process->commands);
+        process->commands = NULL;
+        process->state = process->killRequested ? PROCESS_KILLED : PROCESS_EXITED;
+    }
+    else
+    {
+        process->state = PROCESS_READY;
+    }
+    pthread_mutex_unlock(&os->processLock);
+
+    if (!finished)
+    {
+        submitTask(&os->scheduler, runProcessSlice, process);
+    }
+}
+
+/* Worker of the current thread, if it belongs to a pool */
+static _Thread_local Worker *currentWorker = NULL;
+
+void startThreadPool(ThreadPool *pool, int workerCount)
+{
+    pool->workers = reallocOrExit(NULL, workerCount * sizeof(Worker));
+    memset(pool->workers, 0, workerCount * sizeof(Worker));
+
+    pool->workerCount = workerCount;
+    atomic_init(&pool->nextWorker, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->sleepers, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->stopping = false;
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]);
+    }
+}
+
+/* Wait until no task is queued or running, then join the workers */
+void stopThreadPool(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) > 0)
+    {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->workerCount; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].tasks);
+    }
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->idle);
+}
+
+/* Queue a task: on the submitting worker's own queue, or round-robin from outside */
+void submitTask(ThreadPool *pool, void (*run)(void *arg), void *arg)
+{
+    Worker *worker = currentWorker;
+    if (worker == NULL || worker->pool != pool)
+    {
+        worker = &pool->workers[atomic_fetch_add(&pool->nextWorker, 1) % pool->workerCount];
+    }
+
+    atomic_fetch_add(&pool->pending, 1);
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == worker->capacity)
+    {
+        int capacity = worker->capacity == 0 ? 16 : worker->capacity * 2;
+        Task *tasks = reallocOrExit(NULL, capacity * sizeof(Task));
+        for (int i = 0; i < worker->count; i++)
+        {
+            tasks[i] = worker->tasks[(worker->head + i) % worker->capacity];
+        }
+        free(worker->tasks);
+        worker->tasks = tasks;
+        worker->head = 0;
+        worker->capacity = capacity;
+    }
+    worker->tasks[(worker->head + worker->count) % worker->capacity] = (Task){run, arg};
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+
+    /* Pairs with the sleepers/queued check in workerMain so no wakeup is lost */
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->sleepers) > 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* Take from our own queue first, then steal from the others */
+bool takeTask(ThreadPool *pool, int worker, Task *task)
+{
+    for (int i = 0; i < pool->workerCount; i++)
+    {
+        Worker *victim = &pool->workers[(worker + i) % pool->workerCount];
+        bool found = false;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count > 0)
+        {
+            if (i == 0)
+            {
+                *task = victim->tasks[victim->head];
+                victim->head = (victim->head + 1) % victim->capacity;
+            }
+            else
+            {
+                *task = victim->tasks[(victim->head + victim->count - 1) % victim->capacity];
+            }
+            victim->count--;
+            found = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (found)
+        {
+            atomic_fetch_sub(&pool->queued, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void *workerMain(void *arg)
+{
+    Worker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    currentWorker = worker;
+
+    for (;;)
+    {
+        Task task;
+        if (takeTask(pool, worker->index, &task))
+        {
+            task.run(task.arg);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1)
+            {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->idle);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->queued) <= 0 && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        bool stop = pool->stopping && atomic_load(&pool->queued) <= 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Subscribe to changes under a path; a thread prints them as they arrive */
+void watchPath(OSState *os, int cwd, char *path)
+{
+    int root = resolvePath(os, cwd, path);
+    if (root == -1)
+    {
+        printf("File not found: %s\n", path);
+        return;
+    }
+
+    if (os->watcherCount >= MAX_WATCHERS)
+    {
+        printf("Cannot watch: maximum number of watches reached\n");
+        return;
+    }
+
+    Watcher *watcher = reallocOrExit(NULL, sizeof(Watcher));
+    watcher->id = os->nextWatchId++;
+    watcher->root = root;
+    atomic_init(&watcher->head, 0);
+    atomic_init(&watcher->tail, 0);
+    atomic_init(&watcher->dropped, 0);
+    watcher->marker = (size_t)-1;
+    atomic_init(&watcher->active, true);
+    atomic_init(&watcher->sleeping, false);
+    pthread_mutex_init(&watcher->lock, NULL);
+    pthread_cond_init(&watcher->wake, NULL);
+
+    if (pthread_create(&watcher->consumer, NULL, watchConsumer, watcher) != 0)
+    {
+        pthread_mutex_destroy(&watcher->lock);
+        pthread_cond_destroy(&watcher->wake);
+        free(watcher);
+        printf("Cannot watch: unable to start watcher\n");
+        return;
+    }
+
+    os->watchers[os->watcherCount++] = watcher;
+    char *fullPath = entryPath(os, root);
+    printf("Watch %d: %s\n", watcher->id, fullPath);
+    free(fullPath);
+}
+
+void unwatchPath(OSState *os, int id)
+{
+    for (int i = 0; i < os->watcherCount; i++)
+    {
+        if (os->watchers[i]->id == id)
+        {
+            stopWatcher(os->watchers[i]);
+            os->watchers[i] = os->watchers[--os->watcherCount];
+            printf("Stopped watch %d\n", id);
+            return;
+        }
+    }
+    printf("No such watch: %d\n", id);
+}
+
+/* Let the consumer drain what is queued, then free the watcher */
+void stopWatcher(Watcher *watcher)
+{
+    atomic_store(&watcher->active, false);
+    pthread_mutex_lock(&watcher->lock);
+    pthread_cond_signal(&watcher->wake);
+    pthread_mutex_unlock(&watcher->lock);
+
+    pthread_join(watcher->consumer, NULL);
+    pthread_mutex_destroy(&watcher->lock);
+    pthread_cond_destroy(&watcher->wake);
+    free(watcher);
+}
+
+/* Report a change to every watcher whose subtree holds the entry now or,
+ * for moves, held it before. Called with the write lock held.
+ */
+void publishEvent(OSState *os, EventType type, int index, int oldParent, SharedPath *oldPath)
+{
+    SharedPath *path = NULL;
+
+    for (int i = 0; i < os->watcherCount; i++)
+    {
+        Watcher *watcher = os->watchers[i];
+        if (!isAncestor(os, watcher->root, index) &&
+            (oldParent == -1 || !isAncestor(os, watcher->root, oldParent)))
+        {
+            continue;
+        }
+
+        if (path == NULL)
+        {
+            path = sharePath(os, index);
+        }
+        pushEvent(watcher, type, path, oldPath);
+    }
+    releasePath(path);
+}
+
+/* Producer side of a watcher's ring; never blocks */
+void pushEvent(Watcher *watcher, EventType type, SharedPath *path, SharedPath *from)
+{
+    size_t tail = atomic_load_explicit(&watcher->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&watcher->head, memory_order_acquire);
+
+    if (tail - head >= WATCH_QUEUE_LENGTH - 1)
+    {
+        /* Count the drop before looking for a marker: a consumer that has
+         * already passed the last marker either takes this count there or
+         * finds it at the new marker queued below
+         */
+        atomic_fetch_add(&watcher->dropped, 1);
+        if (watcher->marker == (size_t)-1 || head > watcher->marker)
+        {
+            WatchEvent *marker = &watcher->events[tail % WATCH_QUEUE_LENGTH];
+            marker->type = EVENT_OVERFLOW;
+            marker->path = NULL;
+            marker->from = NULL;
+            watcher->marker = tail;
+            tail++;
+        }
+    }
+    else
+    {
+        WatchEvent *event = &watcher->events[tail % WATCH_QUEUE_LENGTH];
+        event->type = type;
+        event->path = path;
+        event->from = from;
+        atomic_fetch_add_explicit(&path->references, 1, memory_order_relaxed);
+        if (from != NULL)
+        {
+            atomic_fetch_add_explicit(&from->references, 1, memory_order_relaxed);
+        }
+        tail++;
+    }
+
+    /* Pairs with the sleeping/tail check in watchConsumer so no wakeup is lost */
+    atomic_store(&watcher->tail, tail);
+    if (atomic_load(&watcher->sleeping))
+    {
+        pthread_mutex_lock(&watcher->lock);
+        pthread_cond_signal(&watcher->wake);
+        pthread_mutex_unlock(&watcher->lock);
+    }
+}
+
+/* Consumer side: print events as they arrive, yielding briefly before sleeping */
+void *watchConsumer(void *arg)
+{
+    static const char *eventNames[] = {"created", "written", "deleted", "moved", "renamed",
+                                       "permissions changed", "directory created", "directory removed"};
+    Watcher *watcher = arg;
+    int idleRounds = 0;
+
+    for (;;)
+    {
+        size_t head = atomic_load_explicit(&watcher->head, memory_order_relaxed);
+        if (head != atomic_load(&watcher->tail))
+        {
+            WatchEvent *event = &watcher->events[head % WATCH_QUEUE_LENGTH];
+            if (event->type == EVENT_OVERFLOW)
+            {
+                /* Step past the marker first so later drops queue a new one */
+                atomic_store_explicit(&watcher->head, head + 1, memory_order_release);
+                long dropped = atomic_exchange(&watcher->dropped, 0);
+                if (dropped > 0)
+                {
+                    printf("[watch %d] overflow: %ld events lost\n", watcher->id, dropped);
+                    fflush(stdout);
+                }
+                idleRounds = 0;
+                continue;
+            }
+            else if (event->from != NULL)
+            {
+                printf("[watch %d] %s %s -> %s\n", watcher->id, eventNames[event->type],
+                       event->from->text, event->path->text);
+            }
+            else
+            {
+                printf("[watch %d] %s %s\n", watcher->id, eventNames[event->type], event->path->text);
+            }
+            fflush(stdout);
+
+            releasePath(event->path);
+            releasePath(event->from);
+            atomic_store_explicit(&watcher->head, head + 1, memory_order_release);
+            idleRounds = 0;
+            continue;
+        }
+
+        if (!atomic_load(&watcher->active))
+        {
+            break;
+        }
+
+        if (++idleRounds < WATCH_SPIN_ROUNDS)
+        {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&watcher->lock);
+        atomic_store(&watcher->sleeping, true);
+        while (atomic_load(&watcher->tail) == head && atomic_load(&watcher->active))
+        {
+            pthread_cond_wait(&watcher->wake, &watcher->lock);
+        }
+        atomic_store(&watcher->sleeping, false);
+        pthread_mutex_unlock(&watcher->lock);
+        idleRounds = 0;
+    }
+    return NULL;
+}
+
+/* Number of online cores, at least one */
+int coreCount()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+/* Join a host directory and a name; the caller frees the result */
+char *joinPath(const char *directory, const char *name)
+{
+    size_t length = strlen(directory);
+    bool slash = length > 0 && directory[length - 1] == '/';
+    char *path = reallocOrExit(NULL, length + strlen(name) + 2);
+
+    sprintf(path, slash ? "%s%s" : "%s/%s", directory, name);
+    return path;
+}
+
+/* Copy a host directory tree into a directory. Worker threads walk the host
+ * tree and read file bodies; this thread, which holds the write lock, links
+ * what they queue into the file system in batches and sorts each directory
+ * listing once at the end.
+ */
+void importTree(OSState *os, int cwd, char *hostDirectory, char *dirname)
+{
+    struct stat info;
+    if (stat(hostDirectory, &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        printf("Host directory not found: %s\n", hostDirectory);
+        return;
+    }
+
+    int target = resolvePath(os, cwd, dirname);
+    if (target == -1 || !os->files[target].isDirectory)
+    {
+        printf("Directory not found: %s\n", dirname);
+        return;
+    }
+
+    ImportJob job;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.ready, NULL);
+    job.head = NULL;
+    job.tail = NULL;
+    job.outstanding = 0;
+    atomic_init(&job.errors, 0);
+    atomic_init(&job.stopped, false);
+
+    ImportNode *root = reallocOrExit(NULL, sizeof(ImportNode));
+    memset(root, 0, sizeof(ImportNode));
+    root->job = &job;
+    root->hostPath = strdup(hostDirectory);
+    root->isDirectory = true;
+    root->index = target;
+    job.directories = root;
+
+    startThreadPool(&job.pool, coreCount());
+    submitImport(&job, scanHostDirectory, root);
+
+    /* Link nodes in as they arrive; a directory is always queued before anything inside it */
+    int files = 0;
+    int directories = 0;
+    pthread_mutex_lock(&job.lock);
+    for (;;)
+    {
+        while (job.head == NULL && job.outstanding > 0)
+        {
+            pthread_cond_wait(&job.ready, &job.lock);
+        }
+        if (job.head == NULL)
+        {
+            break;
+        }
+
+        ImportNode *batch = job.head;
+        job.head = NULL;
+        job.tail = NULL;
+        pthread_mutex_unlock(&job.lock);
+
+        while (batch != NULL)
+        {
+            ImportNode *node = batch;
+            batch = node->next;
+            linkImported(os, node, &files, &directories);
+        }
+
+        pthread_mutex_lock(&job.lock);
+    }
+    pthread_mutex_unlock(&job.lock);
+    stopThreadPool(&job.pool);
+
+    while (job.directories != NULL)
+    {
+        ImportNode *directory = job.directories;
+        job.directories = directory->nextDirectory;
+        if (directory->index != -1)
+        {
+            sortChildren(os, directory->index);
+        }
+        free(directory->hostPath);
+        free(directory);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.ready);
+
+    printf("Imported %d files and %d directories from %s", files, directories, hostDirectory);
+    int errors = atomic_load(&job.errors);
+    printf(errors > 0 ? " (%d errors)\n" : "\n", errors);
+}
+
+/* Link one loaded node into the file system. Existing directories are
+ * merged into and existing files overwritten. Directory nodes stay owned by
+ * the job; file nodes are freed here.
+ */
+void linkImported(OSState *os, ImportNode *node, int *files, int *directories)
+{
+    ImportJob *job = node->job;
+    int parent = node->parent->index;
+    int index = -1;
+
+    /* Skipped once a quota stops the import, or when its directory failed */
+    if (!atomic_load(&job->stopped) && parent != -1)
+    {
+        int nameId = internName(&os->names, node->name, strlen(node->name));
+        int existing = findChild(os, parent, nameId);
+
+        if (existing != -1 && os->files[existing].isDirectory != node->isDirectory)
+        {
+            char *path = entryPath(os, existing);
+            printf("Cannot import %s: %s exists and is of another type\n", node->hostPath, path);
+            free(path);
+            atomic_fetch_add(&job->errors, 1);
+            index = existing;
+        }
+        else if (existing != -1 && node->isDirectory)
+        {
+            index = existing;
+        }
+        else if (existing != -1)
+        {
+            /* Overwrite; the listing is re-sorted when the import ends */
+            File *file = &os->files[existing];
+            if (checkQuota(os, parent, -1, node->size - file->size, 0))
+            {
+                free(file->content);
+                file->content = node->content;
+                node->content = NULL;
+                updateUsage(os, parent, node->size - file->size, 0);
+                file->size = node->size;
+                file->permissions = node->permissions;
+                index = existing;
+                (*files)++;
+                publishEvent(os, EVENT_WRITE, index, -1, NULL);
+            }
+        }
+        else if (checkQuota(os, parent, -1, node->size, 1))
+        {
+            index = allocateEntry(os, parent, nameId, node->isDirectory, node->permissions);
+            appendChild(os, index);
+            os->files[index].content = node->content;
+            os->files[index].size = node->size;
+            node->content = NULL;
+            updateUsage(os, parent, node->size, 1);
+
+            if (node->isDirectory)
+            {
+                (*directories)++;
+            }
+            else
+            {
+                (*files)++;
+            }
+            publishEvent(os, node->isDirectory ? EVENT_MKDIR : EVENT_CREATE, index, -1, NULL);
+        }
+
+        if (index == -1)
+        {
+            printf("Import stopped\n");
+            atomic_store(&job->stopped, true);
+        }
+        else if (os->files[index].isDirectory != node->isDirectory)
+        {
+            index = -1;
+        }
+    }
+
+    if (node->isDirectory)
+    {
+        node->index = index;
+    }
+    else
+    {
+        free(node->content);
+        free(node->hostPath);
+        free(node);
+    }
+}
+
+/* Count a task against the job before handing it to the pool */
+void submitImport(ImportJob *job, void (*run)(void *arg), ImportNode *node)
+{
+    pthread_mutex_lock(&job->lock);
+    job->outstanding++;
+    pthread_mutex_unlock(&job->lock);
+    submitTask(&job->pool, run, node);
+}
+
+void queueImported(ImportJob *job, ImportNode *node)
+{
+    pthread_mutex_lock(&job->lock);
+    node->next = NULL;
+    if (job->tail != NULL)
+    {
+        job->tail->next = node;
+    }
+    else
+    {
+        job->head = node;
+    }
+    job->tail = node;
+    if (node->isDirectory)
+    {
+        node->nextDirectory = job->directories;
+        job->directories = node;
+    }
+    pthread_cond_signal(&job->ready);
+    pthread_mutex_unlock(&job->lock);
+}
+
+void finishImportTask(ImportJob *job)
+{
+    pthread_mutex_lock(&job->lock);
+    if (--job->outstanding == 0)
+    {
+        pthread_cond_signal(&job->ready);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Worker task: queue the subdirectories of a host directory and load its files */
+void scanHostDirectory(void *arg)
+{
+    ImportNode *directory = arg;
+    ImportJob *job = directory->job;
+    if (atomic_load(&job->stopped))
+    {
+        finishImportTask(job);
+        return;
+    }
+
+    DIR *stream = opendir(directory->hostPath);
+    if (stream == NULL)
+    {
+        printf("Cannot read %s: %s\n", directory->hostPath, strerror(errno));
+        atomic_fetch_add(&job->errors, 1);
+        finishImportTask(job);
+        return;
+    }
+
+    struct dirent *item;
+    while (!atomic_load(&job->stopped) && (item = readdir(stream)) != NULL)
+    {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        ImportNode *node = reallocOrExit(NULL, sizeof(ImportNode));
+        memset(node, 0, sizeof(ImportNode));
+        node->job = job;
+        node->parent = directory;
+        node->hostPath = joinPath(directory->hostPath, item->d_name);
+        node->name = node->hostPath + strlen(node->hostPath) - strlen(item->d_name);
+        node->index = -1;
+
+        /* Symbolic links and special files are skipped */
+        struct stat info;
+        if (lstat(node->hostPath, &info) != 0 || !(S_ISDIR(info.st_mode) || S_ISREG(info.st_mode)))
+        {
+            free(node->hostPath);
+            free(node);
+            continue;
+        }
+
+        node->isDirectory = S_ISDIR(info.st_mode);
+        node->permissions = (info.st_mode >> 6) & 7;
+        if (node->isDirectory)
+        {
+            /* Queue the directory itself before anything can be found inside it */
+            queueImported(job, node);
+            submitImport(job, scanHostDirectory, node);
+        }
+        else
+        {
+            submitImport(job, loadHostFile, node);
+        }
+    }
+    closedir(stream);
+    finishImportTask(job);
+}
+
+/* Worker task: read a whole host file into the buffer its entry will own */
+void loadHostFile(void *arg)
+{
+    ImportNode *node = arg;
+    ImportJob *job = node->job;
+    if (atomic_load(&job->stopped))
+    {
+        free(node->hostPath);
+        free(node);
+        finishImportTask(job);
+        return;
+    }
+
+    int fd = open(node->hostPath, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0)
+    {
+        printf("Cannot read %s: %s\n", node->hostPath, strerror(errno));
+        atomic_fetch_add(&job->errors, 1);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        free(node->hostPath);
+        free(node);
+        finishImportTask(job);
+        return;
+    }
+
+    long size = 0;
+    if (info.st_size > 0)
+    {
+        node->content = reallocOrExit(NULL, info.st_size + 1);
+        while (size < info.st_size)
+        {
+            ssize_t count = read(fd, node->content + size, info.st_size - size);
+            if (count <= 0)
+            {
+                break;
+            }
+            size += count;
+        }
+        node->content[size] = '\0';
+    }
+    close(fd);
+
+    node->size = size;
+    queueImported(job, node);
+    finishImportTask(job);
+}
+
+/* Copy a directory tree out to a host directory. The read lock held for
+ * the command keeps the tree still while workers create the directories
+ * and write each file body directly from its entry's buffer.
+ */
+void exportTree(OSState *os, int cwd, char *dirname, char *hostDirectory)
+{
+    int source = resolvePath(os, cwd, dirname);
+    if (source == -1 || !os->files[source].isDirectory)
+    {
+        printf("Directory not found: %s\n", dirname);
+        return;
+    }
+
+    ExportJob job;
+    job.os = os;
+    atomic_init(&job.files, 0);
+    atomic_init(&job.directories, 0);
+    atomic_init(&job.errors, 0);
+
+    ExportItem *root = reallocOrExit(NULL, sizeof(ExportItem));
+    root->job = &job;
+    root->index = source;
+    root->hostPath = strdup(hostDirectory);
+
+    startThreadPool(&job.pool, coreCount());
+    submitTask(&job.pool, exportDirectory, root);
+    stopThreadPool(&job.pool);
+
+    printf("Exported %d files and %d directories to %s", atomic_load(&job.files),
+           atomic_load(&job.directories), hostDirectory);
+    int errors = atomic_load(&job.errors);
+    printf(errors > 0 ? " (%d errors)\n" : "\n", errors);
+}
+
+/* Worker task: create a host directory and queue everything inside it */
+void exportDirectory(void *arg)
+{
+    ExportItem *item = arg;
+    ExportJob *job = item->job;
+    OSState *os = job->os;
+
+    /* An existing host directory is merged into; anything else in the way is an error */
+    bool created = mkdir(item->hostPath, 0755) == 0;
+    if (!created && errno == EEXIST)
+    {
+        struct stat info;
+        created = stat(item->hostPath, &info) == 0 && S_ISDIR(info.st_mode);
+        if (!created && errno == EEXIST)
+        {
+            errno = ENOTDIR;
+        }
+    }
+
+    if (!created)
+    {
+        printf("Cannot create %s: %s\n", item->hostPath, strerror(errno));
+        atomic_fetch_add(&job->errors, 1);
+    }
+    else
+    {
+        atomic_fetch_add(&job->directories, 1);
+
+        File *dir = &os->files[item->index];
+        for (int i = 0; i < dir->childCount; i++)
+        {
+            int child = dir->children[SORT_NAME][i];
+            ExportItem *next = reallocOrExit(NULL, sizeof(ExportItem));
+            next->job = job;
+            next->index = child;
+            next->hostPath = joinPath(item->hostPath, nameText(&os->names, os->files[child].nameId));
+            submitTask(&job->pool, os->files[child].isDirectory ? exportDirectory : exportFile, next);
+        }
+    }
+
+    free(item->hostPath);
+    free(item);
+}
+
+/* Worker task: write one file body to the host in as few calls as possible */
+void exportFile(void *arg)
+{
+    ExportItem *item = arg;
+    ExportJob *job = item->job;
+    File *file = &job->os->files[item->index];
+
+    int fd = open(item->hostPath, O_WRONLY | O_CREAT | O_TRUNC, (file->permissions & 7) << 6);
+    bool written = fd != -1;
+    long offset = 0;
+    while (written && offset < file->size)
+    {
+        ssize_t count = write(fd, file->content + offset, file->size - offset);
+        written = count > 0;
+        offset += written ? count : 0;
+    }
+
+    if (fd != -1 && close(fd) != 0)
+    {
+        written = false;
+    }
+
+    if (written)
+    {
+        atomic_fetch_add(&job->files, 1);
+    }
+    else
+    {
+        printf("Cannot write %s: %s\n", item->hostPath, strerror(errno));
+        atomic_fetch_add(&job->errors, 1);
+    }
+
+    free(item->hostPath);
+    free(item);
+}
+
+/* realloc that shuts the OS down when memory runs out */
+void *reallocOrExit(void *pointer, size_t size)
+{
+    void *result = realloc(pointer, size);
+    if (result == NULL && size > 0)
+    {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return result;
 }
 
 void showHelp()
 {
     printf("Available commands:\n");
-    printf("  list / ls              : List all files\n");
+    printf("  ls [order] [n] [cur]   : List files by name, size or type, n per page from cur (also list)\n");
     printf("  create [filename]      : Create a new file\n");
     printf("  write [filename]       : Write content to a file\n");
     printf("  read / cat [filename]  : Display file content\n");
@@ -793,6 +3025,15 @@ void showHelp()
     printf("  rmdir [dirname]        : Remove an empty directory\n");
     printf("  cd [dirname]           : Change to directory\n");
     printf("  chmod [file] [perm]    : Change file permissions (0-7)\n");
+    printf("  du [path]              : Show space used by a file or directory\n");
+    printf("  quota [dir] [b] [n]    : Limit a directory to b bytes and n entries (0 = none)\n");
+    printf("  run [script]           : Run an executable file's commands as a process\n");
+    printf("  ps                     : List processes\n");
+    printf("  kill [pid]             : Stop a process\n");
+    printf("  watch [path]           : Report changes under a path as they happen\n");
+    printf("  unwatch [id]           : Stop a watch\n");
+    printf("  import [host] [dir]    : Copy a host directory tree into a directory\n");
+    printf("  export [dir] [host]    : Copy a directory tree out to a host directory\n");
     printf("  help                   : Show this help\n");
     printf("  exit / quit            : Exit the OS\n");
 }
\ No newline at end of file